@@ -0,0 +1,46 @@
+#include <Arduino.h>
+// Async Print: send a long help text in the background from flash,
+// while loop() keeps blinking the LED.
+//
+// DietSerialAsync.h must be included in only one file of the sketch.
+// It uses 22 bytes of RAM for a queue of 4 (3 usable) entries; there is
+// no transmit buffer: the interrupt handler reads the text straight from
+// flash.
+// ============================================================================
+#include "DietSerial.h"
+#include "DietSerialAsync.h"
+
+static const char HelpText[] PROGMEM =
+    "DietSerial asynchronous printing example.\r\n"
+    "This text is sent from flash by the USART interrupt handler,\r\n"
+    "one byte at a time, while loop() goes on blinking the LED.\r\n"
+    "At 9600 baud these three lines take about a fifth of a second.\r\n";
+
+static const uint8_t LEDPIN = 13;
+
+void setup()
+{
+    pinMode(LEDPIN, OUTPUT);
+    DietSerial.begin();
+
+    DietSerialAsync.printP(HelpText);       // returns at once.
+    DietSerialAsync.println(F("----"));
+}
+
+unsigned long loopCount = 0;
+
+void loop()
+{
+    ++loopCount;
+    digitalWrite(LEDPIN, (millis() / 100) & 1);
+
+    // Once the queue is empty, report how often loop() ran meanwhile.
+    static bool reported = false;
+    if (!reported && !DietSerialAsync.busy())
+    {
+        reported = true;
+        DietSerial.print(F("loop() ran "));     // blocking print is fine too.
+        DietSerial.print(loopCount);
+        DietSerial.println(F(" times while the text was being sent."));
+    }
+}
@@ -7,14 +7,22 @@
 // Then comment out the USE_DIETSERIAL 1 line, and uncomment the one below it
 // to use Serial instead. Compile again and note the program memory and
 // SRAM usage.
+//
+// USE_DIETSERIAL 2 prints through DietSerialStream, the Print/Stream adapter
+// that other libraries can use, to see what the adapter costs.
 
 
 //#define USE_DIETSERIAL 1
 #define USE_DIETSERIAL 0   // For serial
+//#define USE_DIETSERIAL 2   // DietSerial through DietSerialStream
 
 #if defined(USE_DIETSERIAL)
 
-#if USE_DIETSERIAL
+#if USE_DIETSERIAL == 2
+#include "DietSerialStream.h"
+#define SENDER DietSerialStream
+
+#elif USE_DIETSERIAL
 #include "DietSerial.h"
 #define SENDER DietSerial
 
@@ -0,0 +1,55 @@
+#include <Arduino.h>
+// Stack Depth: measure how much stack some DietSerial functions use, on
+// top of the RAM the sketch uses permanently.
+//
+// Each measurement paints the free RAM, calls the function, and reports
+// the deepest the stack went, less what it was before the call.
+// Add your own functions to the list to budget your sketch's RAM.
+// ============================================================================
+#include "DietSerial.h"
+
+char   lineBuf[16];
+size_t before;
+
+static void start(void)
+{
+    DietSerial.stackPaint();
+    before = DietSerial.stackHighWater();
+}
+
+static void report(const __FlashStringHelper* name)
+{
+    size_t used = DietSerial.stackHighWater() - before;
+    DietSerial.println();
+    DietSerial.print(name);
+    DietSerial.tab();
+    DietSerial.print(used);
+    DietSerial.println(F(" bytes of stack"));
+}
+
+void setup()
+{
+    DietSerial.begin();
+    DietSerial.println(F("Stack used by each call, in bytes."));
+
+    start(); DietSerial.write('x');                 report(F("write(char)"));
+    start(); DietSerial.print(F("flash text"));     report(F("print(F())"));
+    start(); DietSerial.print(12345);               report(F("print(int)"));
+    start(); DietSerial.print(-1234567890L);        report(F("print(long)"));
+    start(); DietSerial.print(0xFFFFFFFFUL, BIN);   report(F("print(ul, BIN)"));
+    start(); DietSerial.print(3.14159);             report(F("print(double)"));
+    start(); DietSerial.printHex(0xA5);             report(F("printHex()"));
+    start(); DietSerial.dumpHex(lineBuf, 16);       report(F("dumpHex()"));
+
+    DietSerial.println(F("Type a number and press Enter:"));
+    start(); DietSerial.parseFloat();               report(F("parseFloat()"));
+
+    DietSerial.println(F("Type a line of text and press Enter:"));
+    start(); DietSerial.readString(lineBuf, sizeof(lineBuf));
+    report(F("readString()"));
+
+    DietSerial.print(F("Deepest the stack has been: "));
+    DietSerial.println(DietSerial.stackHighWater());
+}
+
+void loop() {}
@@ -0,0 +1,121 @@
+// dietserial_baud: host end of DietSerial.negotiateBaud().
+//
+// Waits for the board to propose baud rates, accepts those up to maxbaud,
+// runs the echo test, and leaves the tty at the agreed rate. With -c it
+// then copies everything the board sends to standard output.
+//
+//   g++ -O2 -o dietserial_baud dietserial_baud.cpp
+//   ./dietserial_baud [-c] /dev/ttyUSB0 [startbaud [maxbaud]]
+//
+// The protocol is described in src/DietSerial.cpp, above negotiateBaud().
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static const uint8_t ENQ = 0x05;
+static const uint8_t ACK = 0x06;
+static const uint8_t NAK = 0x15;
+
+static const uint8_t TestPattern[] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x80, 0x01};
+
+// Milliseconds to wait for the board's next proposal. The board waits for
+// the line to be quiet for 1 to 2 seconds after a failed attempt.
+static const int ProposalTimeoutMs = 10000;
+static const int EchoTimeoutMs     = 300;
+
+// Run the echo test at the new rate. True if every byte came back intact.
+static bool echoTest(int fd)
+{
+    usleep(20000);      // give the board time to change its registers.
+    discardInput(fd);
+    for (uint8_t b : TestPattern)
+    {
+        if (!writeByte(fd, b)) return false;
+        if (readByte(fd, EchoTimeoutMs) != b) return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    bool copyOut = false;
+    int  arg = 1;
+    if ((argc > arg) && (strcmp(argv[arg], "-c") == 0)) {copyOut = true; ++arg;}
+    if (argc <= arg)
+    {
+        fprintf(stderr, "usage: %s [-c] tty [startbaud [maxbaud]]\n", argv[0]);
+        return 2;
+    }
+    const char*   path     = argv[arg];
+    unsigned long baud     = (argc > arg + 1)? strtoul(argv[arg + 1], 0, 10) : 9600;
+    unsigned long maxBaud  = (argc > arg + 2)? strtoul(argv[arg + 2], 0, 10) : 1000000;
+
+    int fd = openTty(path, baud);
+    if (fd < 0) return 1;
+
+    bool agreed = false;
+    while (!agreed)
+    {
+        // Skip ordinary text until a proposal arrives.
+        int c;
+        do {c = readByte(fd, ProposalTimeoutMs);} while ((c >= 0) && (c != ENQ));
+        if (c < 0) break;   // board has stopped proposing.
+
+        unsigned long proposed = 0;
+        bool complete = true;
+        for (int i = 0; i < 4; i++)
+        {
+            int b = readByte(fd, EchoTimeoutMs);
+            if (b < 0) {complete = false; break;}
+            proposed |= (unsigned long)b << (8 * i);  // little-endian long.
+        }
+        if (!complete) continue;
+
+        if ((proposed > maxBaud) || (proposed <= baud))
+        {
+            writeByte(fd, NAK);
+            continue;
+        }
+
+        writeByte(fd, ACK);
+        drain(fd);
+        if (setBaud(fd, proposed) && echoTest(fd))
+        {
+            writeByte(fd, ACK);
+            drain(fd);
+            baud = proposed;
+            agreed = true;
+        }
+        else
+        {
+            // Go quiet and back to the old rate; the board does the same.
+            setBaud(fd, baud);
+            usleep(50000);
+            discardInput(fd);
+        }
+    }
+
+    fprintf(stderr, "%s: %lu baud%s\n", path, baud, agreed? "" : " (unchanged)");
+
+    if (copyOut)
+    {
+        uint8_t buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            if (fwrite(buf, 1, n, stdout) != (size_t)n) break;
+            fflush(stdout);
+        }
+    }
+    close(fd);
+    return agreed? 0 : 1;
+}
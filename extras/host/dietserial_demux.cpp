@@ -0,0 +1,226 @@
+// dietserial_demux: split DietSerial.channel() output into one file or pty
+// per channel.
+//
+// The board sends DLE (0x10) and the channel number 0-15 when it changes
+// channel, and always before channel 0 output, and sends DLE in the data
+// twice. Untagged data belongs to the channel of the last tag, channel 0
+// before the first one. This program removes the tags and writes each
+// channel's data on its own, to prefix.0, prefix.1 ...
+//
+// With -p it makes a pty for each of channels 0 to n-1 instead, and
+// prefix.0 ... are symbolic links to them, so that a terminal program can
+// show the debug text on one while a parser reads the binary telemetry from
+// another. Anything written to a channel's pty is tagged and sent to the
+// board, for ChannelDemux on the board to hand to that channel's handler.
+//
+//   g++ -O2 -o dietserial_demux dietserial_demux.cpp
+//   ./dietserial_demux /dev/ttyUSB0 115200 log        # log.0, log.1 ...
+//   ./dietserial_demux -p 3 /dev/ttyUSB0 115200 ch    # ch.0 -> /dev/pts/5 ...
+//   ./dietserial_demux - 0 log < capture.bin
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <string>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static const uint8_t ChannelDLE = 0x10;
+static const int     Channels   = 16;
+
+static std::string   prefix = "channel";
+static bool          usePty = false;
+static int           out[Channels];         // file or pty master, -1 = none.
+static unsigned long dropped[Channels];     // pty full: nobody reading it.
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) {stop = 1;}
+
+static std::string channelPath(int n)
+{
+    return prefix + "." + std::to_string(n);
+}
+
+// pty master, raw, non-blocking; prefix.n links to the slave. The slave is
+// kept open here as well, so the master doesn't report hang-ups while no
+// program has it open.
+static bool openPty(int n)
+{
+    int m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((m < 0) || (grantpt(m) < 0) || (unlockpt(m) < 0)) {perror("pty"); return false;}
+    const char* slave = ptsname(m);
+    if (open(slave, O_RDWR | O_NOCTTY) < 0) {perror(slave); return false;}
+
+    struct termios2 tio;
+    ioctl(m, TCGETS2, &tio);
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL;
+    ioctl(m, TCSETS2, &tio);
+
+    std::string link = channelPath(n);
+    unlink(link.c_str());
+    if (symlink(slave, link.c_str()) < 0) perror(link.c_str());
+    fprintf(stderr, "channel %d: %s -> %s\n", n, link.c_str(), slave);
+    out[n] = m;
+    return true;
+}
+
+static void deliver(int n, const uint8_t* data, size_t len)
+{
+    if (len == 0) return;
+    if (!usePty && (out[n] < 0))
+    {
+        std::string path = channelPath(n);
+        out[n] = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out[n] < 0) {perror(path.c_str()); stop = 1; return;}
+    }
+    if (out[n] < 0) {dropped[n] += len; return;}   // no pty for channel.
+
+    while (len)
+    {
+        ssize_t w = write(out[n], data, len);
+        if (w < 0)
+        {
+            if (errno == EINTR) continue;
+            dropped[n] += len;  // pty buffer full (EAGAIN).
+            return;
+        }
+        data += w;
+        len  -= w;
+    }
+}
+
+// Board -> host. Bytes for the current channel are collected and written
+// in one go, not one by one.
+struct Splitter
+{
+    int     current = 0;        // data before the first tag is channel 0.
+    bool    escape  = false;
+    uint8_t run[4096];
+    size_t  runLen  = 0;
+
+    void flushRun() {deliver(current, run, runLen); runLen = 0;}
+
+    void feed(const uint8_t* buf, ssize_t n)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t b = buf[i];
+            if (escape)
+            {
+                escape = false;
+                if (b != ChannelDLE)
+                {
+                    flushRun();
+                    current = b & 0x0F;
+                    continue;
+                }
+            }
+            else if (b == ChannelDLE) {escape = true; continue;}
+            run[runLen++] = b;
+            if (runLen == sizeof(run)) flushRun();
+        }
+        flushRun();
+    }
+};
+
+// Host -> board: tag the data with its channel, double any DLE.
+static void sendToBoard(int tty, int n, const uint8_t* data, ssize_t len)
+{
+    uint8_t framed[2 + 2 * 4096];
+    size_t  k = 0;
+    framed[k++] = ChannelDLE;
+    framed[k++] = n;
+    for (ssize_t i = 0; i < len; i++)
+    {
+        if (data[i] == ChannelDLE) framed[k++] = ChannelDLE;
+        framed[k++] = data[i];
+    }
+    for (size_t done = 0; done < k; )
+    {
+        ssize_t w = write(tty, framed + done, k - done);
+        if (w <= 0) {if (errno == EINTR) continue; perror("write"); stop = 1; return;}
+        done += w;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int arg = 1;
+    int ptys = 0;
+    if ((argc > 2) && (strcmp(argv[1], "-p") == 0))
+    {
+        usePty = true;
+        ptys = atoi(argv[2]);
+        if ((ptys < 1) || (ptys > Channels)) ptys = Channels;
+        arg = 3;
+    }
+    if (argc <= arg)
+    {
+        fprintf(stderr, "usage: %s [-p n] tty|- [baud [prefix]]\n", argv[0]);
+        return 2;
+    }
+    const char*   path = argv[arg];
+    unsigned long baud = (argc > arg + 1)? strtoul(argv[arg + 1], 0, 10) : 9600;
+    if (argc > arg + 2) prefix = argv[arg + 2];
+
+    int fd = 0;     // standard input
+    if (strcmp(path, "-") != 0)
+    {
+        fd = openTty(path, baud);
+        if (fd < 0) return 1;
+    }
+
+    for (int n = 0; n < Channels; n++) out[n] = -1;
+    for (int n = 0; n < ptys; n++) if (!openPty(n)) return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;   // no SA_RESTART: let poll() return.
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    // pfd[0] is the board; pfd[1 + n] the pty for channel n.
+    struct pollfd pfd[1 + Channels];
+    pfd[0] = {fd, POLLIN, 0};
+    for (int n = 0; n < ptys; n++) pfd[1 + n] = {out[n], POLLIN, 0};
+    // Can't send to the board through standard input.
+    const int nfds = (fd == 0)? 1 : 1 + ptys;
+
+    Splitter splitter;
+    uint8_t  buf[4096];
+    while (!stop)
+    {
+        if (poll(pfd, nfds, -1) < 0) {if (errno == EINTR) continue; perror("poll"); break;}
+
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;      // end of capture file, or board unplugged.
+            splitter.feed(buf, n);
+        }
+        for (int c = 0; c < nfds - 1; c++)
+        {
+            if (!(pfd[1 + c].revents & POLLIN)) continue;
+            ssize_t n = read(out[c], buf, sizeof(buf));
+            if (n > 0) sendToBoard(fd, c, buf, n);
+        }
+    }
+
+    for (int n = 0; n < Channels; n++)
+    {
+        if (dropped[n]) fprintf(stderr, "channel %d: %lu bytes dropped\n", n, dropped[n]);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+// dietserial_echo: send back everything received, for DietSerial.selfTest().
+//
+// Echoes each chunk as soon as it arrives, and on Ctrl-C prints how many
+// bytes it echoed. The round trip through the USB adapter and this program
+// is part of what selfTest() measures: expect a millisecond or so of
+// latency, against tens of microseconds with a wire from TX to RX.
+//
+//   g++ -O2 -o dietserial_echo dietserial_echo.cpp
+//   ./dietserial_echo /dev/ttyUSB0 1000000
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) {stop = 1;}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s tty [baud]\n", argv[0]);
+        return 2;
+    }
+    unsigned long baud = (argc > 2)? strtoul(argv[2], 0, 10) : 9600;
+
+    int fd = openTty(argv[1], baud);
+    if (fd < 0) return 1;
+    discardInput(fd);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;   // no SA_RESTART: let read() return.
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    unsigned long total = 0;
+    uint8_t buf[4096];
+    ssize_t n;
+    while (!stop && ((n = read(fd, buf, sizeof(buf))) > 0))
+    {
+        for (ssize_t done = 0; done < n; )
+        {
+            ssize_t w = write(fd, buf + done, n - done);
+            if (w <= 0) {perror("write"); return 1;}
+            done += w;
+        }
+        total += n;
+    }
+    fprintf(stderr, "%lu bytes echoed\n", total);
+    return 0;
+}
@@ -0,0 +1,492 @@
+// dietserial_ingest: record binary or text streams from many boards at once.
+//
+// Reads any number of ttys (or ptys) with epoll, splits each stream into
+// records, and appends them, with the time each arrived, to column files:
+// one memory-mapped file per field, so that each column is a plain array
+// that numpy.fromfile(), R or a C program can read straight in.
+//
+// A record is either a line of text from println() (CR-LF or LF), or a
+// fixed sequence of the binary values write() sends, given as letters:-
+//   b  uint8_t         write(uint8_t)            1 byte
+//   c  int8_t          write(char)               1 byte
+//   i  int16_t         write(int)                2 bytes, little-endian
+//   u  uint16_t        write(unsigned int)       2 bytes
+//   l  int32_t         write(long)               4 bytes
+//   L  uint32_t        write(unsigned long)      4 bytes
+//   f  float           write(float), write(double)  4 bytes, IEEE 754
+// e.g. "ilf" for write(int), write(long), write(float). Binary streams have
+// no framing of their own; with -m the board sends a marker byte before
+// each record, and the reader skips to the next marker if it gets lost.
+//
+// For a tty /dev/ttyUSB0, the files in the output directory are:-
+//   ttyUSB0.ts         int64_t  arrival time, nanoseconds since 1970
+//   ttyUSB0.0i ...     one per field: the field number and letter
+//   ttyUSB0.text       text mode: the lines, each ending in LF
+//   ttyUSB0.offset     text mode: uint64_t start of each line in .text
+//
+//   g++ -O2 -pthread -o dietserial_ingest dietserial_ingest.cpp
+//   ./dietserial_ingest -b 1000000 -o data ilf /dev/ttyUSB0 /dev/ttyUSB1
+//   ./dietserial_ingest -m 0xA5 -o data lf /dev/ttyACM0
+//   ./dietserial_ingest -o logs text /dev/ttyUSB0
+//
+// Benchmark, without hardware: producer threads write records to ptys as
+// fast as they can, or at a given number of records per second each, and
+// the tool reports the records and bytes per second it recorded and the
+// latency from write to record:-
+//   ./dietserial_ingest bench [producers [seconds [rate]]]
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) {stop = 1;}
+
+static int64_t nanosNow(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+// Append-only memory-mapped file. Grows by doubling; cut to size on close.
+
+struct Column
+{
+    std::string path;
+    int         fd   = -1;
+    uint8_t*    map  = nullptr;
+    size_t      used = 0;
+    size_t      cap  = 0;
+
+    bool open(const std::string& p)
+    {
+        path = p;
+        fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {perror(p.c_str()); return false;}
+        return grow(1 << 20);
+    }
+
+    bool grow(size_t need)
+    {
+        size_t newCap = std::max(need, cap * 2);
+        if (ftruncate(fd, newCap) < 0) {perror(path.c_str()); return false;}
+        void* m = map? mremap(map, cap, newCap, MREMAP_MAYMOVE)
+                     : mmap(0, newCap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {perror(path.c_str()); return false;}
+        map = (uint8_t*)m;
+        cap = newCap;
+        return true;
+    }
+
+    void append(const void* data, size_t len)
+    {
+        if ((used + len > cap) && !grow(used + len)) {stop = 1; return;}
+        memcpy(map + used, data, len);
+        used += len;
+    }
+
+    void close()
+    {
+        if (fd < 0) return;
+        munmap(map, cap);
+        if (ftruncate(fd, used) < 0) perror(path.c_str());
+        ::close(fd);
+        fd = -1;
+    }
+};
+
+// -----------------------------------------------------------------------------
+// One board.
+
+static int fieldSize(char type)
+{
+    switch (type)
+    {
+        case 'b': case 'c':           return 1;
+        case 'i': case 'u':           return 2;
+        case 'l': case 'L': case 'f': return 4;
+    }
+    return 0;
+}
+
+struct Source
+{
+    std::string name;
+    int         fd = -1;
+    std::string format;         // field letters, or empty for text.
+    int         marker = -1;    // byte before each binary record, or -1.
+    size_t      recordSize = 0; // binary, without the marker.
+
+    Column              ts;
+    std::vector<Column> fields;
+    Column              text;
+    Column              offset;
+
+    std::vector<uint8_t> pending;   // start of an incomplete record.
+    unsigned long long   records = 0;
+    unsigned long long   bytes   = 0;
+    unsigned long long   skipped = 0;   // looking for the marker.
+
+    // Benchmark: field 0 is the producer's send time, in microseconds.
+    std::vector<uint32_t>* latencies = nullptr;
+
+    bool open(const std::string& dir)
+    {
+        std::string base = dir + "/" + name.substr(name.rfind('/') + 1);
+        if (!ts.open(base + ".ts")) return false;
+        if (format.empty())
+            return text.open(base + ".text") && offset.open(base + ".offset");
+        fields.resize(format.size());
+        for (size_t k = 0; k < format.size(); k++)
+        {
+            if (!fields[k].open(base + "." + std::to_string(k) + format[k]))
+                return false;
+            recordSize += fieldSize(format[k]);
+        }
+        return true;
+    }
+
+    void close()
+    {
+        ts.close();
+        for (auto& c : fields) c.close();
+        text.close();
+        offset.close();
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    void binaryRecord(const uint8_t* p, int64_t now, uint32_t nowMicros)
+    {
+        ts.append(&now, sizeof(now));
+        for (size_t k = 0; k < format.size(); k++)
+        {
+            // Little-endian on the wire, as the ATmega stores them.
+            switch (format[k])
+            {
+                case 'b': {uint8_t  v = p[0];                        fields[k].append(&v, 1); break;}
+                case 'c': {int8_t   v = (int8_t)p[0];                fields[k].append(&v, 1); break;}
+                case 'i': {int16_t  v = (int16_t)(p[0] | (p[1] << 8)); fields[k].append(&v, 2); break;}
+                case 'u': {uint16_t v = (uint16_t)(p[0] | (p[1] << 8)); fields[k].append(&v, 2); break;}
+                case 'l': case 'L': case 'f':
+                {
+                    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+                               | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+                    fields[k].append(&v, 4);   // same bits for int32, float.
+                    if ((k == 0) && latencies && (latencies->size() < latencies->capacity()))
+                        latencies->push_back(nowMicros - v);
+                    break;
+                }
+            }
+            p += fieldSize(format[k]);
+        }
+        ++records;
+    }
+
+    void textLine(const uint8_t* p, size_t len, int64_t now)
+    {
+        if (len && (p[len - 1] == '\r')) --len;
+        uint64_t start = text.used;
+        ts.append(&now, sizeof(now));
+        offset.append(&start, sizeof(start));
+        text.append(p, len);
+        text.append("\n", 1);
+        ++records;
+    }
+
+    // Split buf, after whatever was pending, into records.
+    void feed(const uint8_t* buf, size_t n)
+    {
+        const int64_t  now       = nanosNow(CLOCK_REALTIME);
+        const uint32_t nowMicros = nanosNow(CLOCK_MONOTONIC) / 1000;
+        bytes += n;
+
+        // Work on buf directly when nothing is pending, the usual case.
+        const uint8_t* p = buf;
+        const uint8_t* end = buf + n;
+        if (!pending.empty())
+        {
+            pending.insert(pending.end(), buf, buf + n);
+            p = pending.data();
+            end = p + pending.size();
+        }
+
+        if (format.empty())
+        {
+            const uint8_t* lf;
+            while ((lf = (const uint8_t*)memchr(p, '\n', end - p)))
+            {
+                textLine(p, lf - p, now);
+                p = lf + 1;
+            }
+        }
+        else
+        {
+            const size_t need = recordSize + ((marker >= 0)? 1 : 0);
+            while ((size_t)(end - p) >= need)
+            {
+                if (marker >= 0)
+                {
+                    if (*p != marker) {++p; ++skipped; continue;}
+                    binaryRecord(p + 1, now, nowMicros);
+                }
+                else binaryRecord(p, now, nowMicros);
+                p += need;
+            }
+        }
+
+        // Keep the incomplete rest for next time.
+        std::vector<uint8_t> rest(p, end);
+        pending.swap(rest);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// The epoll loop. Returns when every source has closed, on Ctrl-C, or, if
+// done is given, when it is set and nothing has arrived for 200 ms.
+
+static void ingest(std::vector<Source>& sources, const std::atomic<bool>* done)
+{
+    int ep = epoll_create1(0);
+    size_t open = 0;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        fcntl(sources[i].fd, F_SETFL, fcntl(sources[i].fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, sources[i].fd, &ev) == 0) ++open;
+        else perror(sources[i].name.c_str());
+    }
+
+    static uint8_t buf[65536];
+    struct epoll_event events[64];
+    while (open && !stop)
+    {
+        int n = epoll_wait(ep, events, 64, done? 200 : -1);
+        if (n < 0) {if (errno == EINTR) continue; perror("epoll_wait"); break;}
+        if ((n == 0) && done && *done) break;
+        for (int e = 0; e < n; e++)
+        {
+            Source& s = sources[events[e].data.u32];
+            // Drain it: fewer trips round epoll_wait at high rates.
+            for (;;)
+            {
+                ssize_t got = read(s.fd, buf, sizeof(buf));
+                if (got > 0) {s.feed(buf, got); continue;}
+                if ((got < 0) && ((errno == EAGAIN) || (errno == EINTR))) break;
+                // End of file, or board unplugged (EIO).
+                epoll_ctl(ep, EPOLL_CTL_DEL, s.fd, 0);
+                ::close(s.fd);
+                s.fd = -1;
+                --open;
+                break;
+            }
+        }
+    }
+    close(ep);
+}
+
+static void report(const std::vector<Source>& sources)
+{
+    for (const auto& s : sources)
+    {
+        fprintf(stderr, "%s: %llu records, %llu bytes", s.name.c_str(), s.records, s.bytes);
+        if (s.skipped) fprintf(stderr, ", %llu bytes skipped", s.skipped);
+        if (!s.pending.empty()) fprintf(stderr, ", %zu bytes left over", s.pending.size());
+        fprintf(stderr, "\n");
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark.
+
+static const char BenchFormat[] = "Lfi";   // send time us, value, counter.
+
+static void producer(int fd, int seconds, unsigned long rate, std::atomic<bool>& go)
+{
+    while (!go) std::this_thread::yield();
+    const int64_t stopAt = nanosNow(CLOCK_MONOTONIC) + (int64_t)seconds * 1000000000;
+
+    // Full speed: 256 records per write(). Paced: one record per write().
+    const int batch = rate? 1 : 256;
+    const int64_t interval = rate? 1000000000 / rate : 0;
+    int64_t next = nanosNow(CLOCK_MONOTONIC);
+    uint8_t  buf[256 * 10];
+    uint16_t counter = 0;
+    while (!stop && (nanosNow(CLOCK_MONOTONIC) < stopAt))
+    {
+        if (rate)
+        {
+            int64_t now;
+            while ((now = nanosNow(CLOCK_MONOTONIC)) < next) {}
+            next += interval;
+        }
+        uint8_t* p = buf;
+        for (int r = 0; r < batch; r++)
+        {
+            uint32_t t = nanosNow(CLOCK_MONOTONIC) / 1000;
+            float    f = sinf(counter * 0.01f);
+            uint32_t fb;
+            memcpy(&fb, &f, 4);
+            for (int k = 0; k < 4; k++) *p++ = t  >> (8 * k);
+            for (int k = 0; k < 4; k++) *p++ = fb >> (8 * k);
+            *p++ = counter;
+            *p++ = counter >> 8;
+            ++counter;
+        }
+        for (uint8_t* w = buf; w < p; )
+        {
+            ssize_t n = write(fd, w, p - w);
+            if (n <= 0) {if (errno == EINTR) continue; return;}
+            w += n;
+        }
+    }
+}
+
+static int bench(int producers, int seconds, unsigned long rate)
+{
+    char dir[] = "/tmp/dietserial_ingest.XXXXXX";
+    if (!mkdtemp(dir)) {perror("mkdtemp"); return 1;}
+
+    std::vector<int>      masters(producers);
+    std::vector<Source>   sources(producers);
+    std::vector<uint32_t> latencies;
+    latencies.reserve(4 * 1000 * 1000);
+    for (int i = 0; i < producers; i++)
+    {
+        int m = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((m < 0) || (grantpt(m) < 0) || (unlockpt(m) < 0)) {perror("pty"); return 1;}
+        masters[i] = m;
+        Source& s = sources[i];
+        s.name   = "bench" + std::to_string(i);
+        s.format = BenchFormat;
+        s.fd     = openTty(ptsname(m), 0);  // raw mode, as for a real tty.
+        s.latencies = &latencies;
+        if ((s.fd < 0) || !s.open(dir)) return 1;
+    }
+
+    std::atomic<bool> go(false), done(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; i++)
+        threads.emplace_back(producer, masters[i], seconds, rate, std::ref(go));
+
+    const int64_t start = nanosNow(CLOCK_MONOTONIC);
+    go = true;
+    std::thread waiter([&] {for (auto& t : threads) t.join(); done = true;});
+    ingest(sources, &done);
+    waiter.join();
+    const double elapsed = (nanosNow(CLOCK_MONOTONIC) - start) / 1e9 - 0.2;
+
+    unsigned long long records = 0, bytes = 0;
+    for (auto& s : sources) {records += s.records; bytes += s.bytes; s.close();}
+    for (int m : masters) close(m);
+    report(sources);
+
+    printf("%d producers, %s, %.1f s\n", producers,
+           rate? (std::to_string(rate) + " records/s each").c_str() : "full speed", elapsed);
+    printf("ingested %llu records, %.0f records/s, %.2f MB/s\n",
+           records, records / elapsed, bytes / elapsed / 1e6);
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        auto pct = [&](double q) {return latencies[(size_t)(q * (latencies.size() - 1))];};
+        printf("latency us (first %zu records): median %u, 99%% %u, 99.9%% %u, max %u\n",
+               latencies.size(), pct(0.5), pct(0.99), pct(0.999), latencies.back());
+    }
+
+    // The column files are only of interest to show that they are written.
+    for (auto& s : sources)
+    {
+        unlink(s.ts.path.c_str());
+        for (auto& c : s.fields) unlink(c.path.c_str());
+    }
+    rmdir(dir);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-b baud] [-m marker] [-o dir] text|fields tty...\n"
+                    "       %s bench [producers [seconds [rate]]]\n", prog, prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;   // no SA_RESTART: let epoll_wait() return.
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+    {
+        int producers = (argc > 2)? atoi(argv[2]) : 4;
+        int seconds   = (argc > 3)? atoi(argv[3]) : 5;
+        unsigned long rate = (argc > 4)? strtoul(argv[4], 0, 10) : 0;
+        return bench(std::max(producers, 1), std::max(seconds, 1), rate);
+    }
+
+    unsigned long baud = 9600;
+    int marker = -1;
+    std::string dir = ".";
+    int arg = 1;
+    for (; (arg + 1 < argc) && (argv[arg][0] == '-'); arg += 2)
+    {
+        if      (strcmp(argv[arg], "-b") == 0) baud   = strtoul(argv[arg + 1], 0, 10);
+        else if (strcmp(argv[arg], "-m") == 0) marker = strtol(argv[arg + 1], 0, 0) & 0xFF;
+        else if (strcmp(argv[arg], "-o") == 0) dir    = argv[arg + 1];
+        else {usage(argv[0]); return 2;}
+    }
+    if (argc - arg < 2) {usage(argv[0]); return 2;}
+
+    std::string format = argv[arg++];
+    if (format == "text") format.clear();
+    for (char c : format)
+    {
+        if (!fieldSize(c)) {fprintf(stderr, "unknown field type '%c'\n", c); return 2;}
+    }
+    mkdir(dir.c_str(), 0755);
+
+    std::vector<Source> sources(argc - arg);
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        Source& s = sources[i];
+        s.name   = argv[arg + i];
+        s.format = format;
+        s.marker = marker;
+        s.fd     = openTty(s.name.c_str(), baud);
+        if ((s.fd < 0) || !s.open(dir)) return 1;
+    }
+
+    ingest(sources, nullptr);
+    for (auto& s : sources) s.close();
+    report(sources);
+    return 0;
+}
@@ -0,0 +1,125 @@
+// dietserial_profile: collect PROFILE_BEGIN/PROFILE_END timing records.
+//
+// Reads the 4-byte records sent by PROFILE_FLUSH (0xFE, id, cycles low,
+// cycles high) from a tty or a capture file, skipping any text in between.
+// On end of input or Ctrl-C, prints for each region id: count, min, mean,
+// max cycles, the mean in microseconds, and a histogram of cycle counts in
+// powers of two.
+//
+//   g++ -O2 -o dietserial_profile dietserial_profile.cpp
+//   ./dietserial_profile /dev/ttyUSB0 [baud [cpuhz]]
+//   ./dietserial_profile - < capture.bin
+//
+// See PROFILE_BEGIN in src/DietSerial_macros.h.
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static const uint8_t ProfileMarker = 0xFE;
+
+struct Region
+{
+    unsigned long count;
+    unsigned long min;
+    unsigned long max;
+    double        total;
+    unsigned long histogram[17];    // bucket k: cycles < 2^k.
+};
+
+static Region regions[256];
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) {stop = 1;}
+
+static void record(uint8_t id, uint16_t cycles)
+{
+    Region& r = regions[id];
+    if ((r.count == 0) || (cycles < r.min)) r.min = cycles;
+    if (cycles > r.max) r.max = cycles;
+    r.total += cycles;
+    ++r.count;
+
+    int bucket = 0;
+    while ((bucket < 16) && (cycles >= (1UL << bucket))) ++bucket;
+    ++r.histogram[bucket];
+}
+
+static void report(double cpuHz)
+{
+    printf("%4s %10s %8s %10s %8s %10s\n", "id", "count", "min", "mean", "max", "mean us");
+    for (int id = 0; id < 256; id++)
+    {
+        const Region& r = regions[id];
+        if (r.count == 0) continue;
+        double mean = r.total / r.count;
+        printf("%4d %10lu %8lu %10.1f %8lu %10.2f\n",
+               id, r.count, r.min, mean, r.max, mean * 1e6 / cpuHz);
+    }
+    printf("\nhistogram: number of samples below 2^k cycles, k = 0..16\n");
+    for (int id = 0; id < 256; id++)
+    {
+        const Region& r = regions[id];
+        if (r.count == 0) continue;
+        printf("%4d ", id);
+        for (int k = 0; k <= 16; k++)
+        {
+            if (r.histogram[k]) printf(" <%lu:%lu", 1UL << k, r.histogram[k]);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s tty|- [baud [cpuhz]]\n", argv[0]);
+        return 2;
+    }
+    unsigned long baud  = (argc > 2)? strtoul(argv[2], 0, 10) : 9600;
+    double        cpuHz = (argc > 3)? atof(argv[3]) : 16e6;
+
+    int fd = 0;     // standard input
+    if (strcmp(argv[1], "-") != 0)
+    {
+        fd = openTty(argv[1], baud);
+        if (fd < 0) return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;   // no SA_RESTART: let read() return.
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    // Parser state: bytes of the current record seen so far, 0 = none.
+    uint8_t rec[4];
+    int     have = 0;
+    uint8_t buf[4096];
+    ssize_t n;
+    while (!stop && ((n = read(fd, buf, sizeof(buf))) > 0))
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if ((have == 0) && (buf[i] != ProfileMarker)) continue;  // text.
+            rec[have++] = buf[i];
+            if (have == 4)
+            {
+                record(rec[1], (uint16_t)(rec[2] | (rec[3] << 8)));
+                have = 0;
+            }
+        }
+    }
+    report(cpuHz);
+    return 0;
+}
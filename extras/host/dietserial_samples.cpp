@@ -0,0 +1,262 @@
+// dietserial_samples: decoder and benchmark for DietSerial.writeSamples().
+//
+// decode: read blocks of n samples from a tty or capture file and print one
+//         sample per line, with a blank line between blocks.
+// bench:  encode a trace (one integer per line; a synthetic ADC trace if no
+//         file is given), check that it decodes to the same samples, and
+//         report the compression ratio, the sample rate that gives at a
+//         baud rate, and encode/decode speed on this PC.
+//
+//   g++ -O2 -o dietserial_samples dietserial_samples.cpp
+//   ./dietserial_samples decode /dev/ttyUSB0 baud n
+//   ./dietserial_samples decode - n < capture.bin
+//   ./dietserial_samples bench [trace.txt [baud]]
+//
+// The encoder and decoder here follow writeSamples() and readSamples() in
+// src/DietSerial.cpp; the format is described above writeSamples().
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static const uint8_t BlockStart = 0xFF;
+
+// Encoder
+// =======
+
+static void putValue(std::vector<uint8_t>& out, int16_t v)
+{
+    uint8_t hi = (uint16_t)v >> 8;
+    uint8_t lo = (uint8_t)v;
+    out.push_back(0xE0 | (hi >> 6));
+    out.push_back(((hi << 1) | (lo >> 7)) & 0x7f);
+    out.push_back(lo & 0x7f);
+}
+
+static void encode(const int16_t* x, size_t n, std::vector<uint8_t>& out)
+{
+    if (n == 0) return;
+    out.push_back(BlockStart);
+    putValue(out, x[0]);
+
+    size_t i = 1;
+    while (i < n)
+    {
+        int16_t d = (int16_t)(x[i] - x[i - 1]);
+        if (d == 0)
+        {
+            size_t r = 1;
+            while ((i + r < n) && (r < 1024) && (x[i + r] == x[i])) ++r;
+            if (r >= 3)
+            {
+                --r;
+                out.push_back(0xF0 | (r >> 7));
+                out.push_back(r & 0x7f);
+                i += r + 1;
+                continue;
+            }
+        }
+        if ((d >= -4) && (d <= 3) && (i + 1 < n))
+        {
+            int16_t d2 = (int16_t)(x[i + 1] - x[i]);
+            if ((d2 >= -4) && (d2 <= 3))
+            {
+                out.push_back(0x80 | ((d & 7) << 3) | (d2 & 7));
+                i += 2;
+                continue;
+            }
+        }
+        if ((d >= -64) && (d <= 63))            out.push_back(d & 0x7f);
+        else if ((d >= -2048) && (d <= 2047))
+        {
+            out.push_back(0xC0 | ((d >> 7) & 0x1f));
+            out.push_back(d & 0x7f);
+        }
+        else putValue(out, x[i]);
+        ++i;
+    }
+}
+
+// Decoder
+// =======
+// next() returns the next byte, or -1 at end of input.
+
+template <typename Next>
+static size_t decode(Next next, int16_t* y, size_t n)
+{
+    int c;
+    do {c = next();} while ((c >= 0) && (c != BlockStart));
+    if (c < 0) return 0;
+
+    int16_t prev = 0;
+    size_t  i = 0;
+    while (i < n)
+    {
+        int t = next();
+        if (t < 0) return i;
+        if (t < 0x80)
+        {
+            prev += (t & 0x40)? (int16_t)(t | 0xff80) : t;
+            y[i++] = prev;
+            continue;
+        }
+        if (t < 0xC0)
+        {
+            int d1 = (t >> 3) & 7, d2 = t & 7;
+            if (d1 & 4) d1 -= 8;
+            if (d2 & 4) d2 -= 8;
+            if (i + 2 > n) return i;
+            prev += d1; y[i++] = prev;
+            prev += d2; y[i++] = prev;
+            continue;
+        }
+        if (t == BlockStart) return i;
+        int t2 = next();
+        if ((t2 < 0) || (t2 & 0x80)) return i;
+        if (t < 0xE0)
+        {
+            uint16_t v = ((t & 0x1f) << 7) | t2;
+            if (v & 0x0800) v |= 0xf000;
+            prev += (int16_t)v;
+            y[i++] = prev;
+        }
+        else if (t < 0xF0)
+        {
+            int t3 = next();
+            if ((t3 < 0) || (t3 & 0x80)) return i;
+            uint16_t v = ((t & 3) << 14) | (t2 << 7) | t3;
+            prev = (int16_t)v;
+            y[i++] = prev;
+        }
+        else if (t < 0xF8)
+        {
+            size_t r = (((t & 7) << 7) | t2) + 1;
+            if (i + r > n) return i;
+            while (r--) y[i++] = prev;
+        }
+        else return i;
+    }
+    return i;
+}
+
+// Modes
+// =====
+
+static int decodeMode(const char* path, unsigned long baud, size_t n)
+{
+    int fd = 0;
+    if (strcmp(path, "-") != 0)
+    {
+        fd = openTty(path, baud);
+        if (fd < 0) return 1;
+    }
+    static uint8_t buf[4096];
+    static ssize_t len = 0, pos = 0;
+    auto next = [fd]() -> int
+    {
+        if (pos == len)
+        {
+            len = read(fd, buf, sizeof(buf));
+            pos = 0;
+            if (len <= 0) return -1;
+        }
+        return buf[pos++];
+    };
+
+    std::vector<int16_t> y(n);
+    size_t got;
+    while ((got = decode(next, y.data(), n)) > 0)
+    {
+        for (size_t i = 0; i < got; i++) printf("%d\n", y[i]);
+        if (got < n) fprintf(stderr, "damaged block: %zu of %zu samples\n", got, n);
+        printf("\n");
+    }
+    return 0;
+}
+
+static int benchMode(const char* path, unsigned long baud)
+{
+    std::vector<int16_t> x;
+    if (path)
+    {
+        FILE* f = fopen(path, "r");
+        if (!f) {perror(path); return 1;}
+        int v;
+        while (fscanf(f, "%d", &v) == 1) x.push_back((int16_t)v);
+        fclose(f);
+    }
+    else
+    {
+        // 10-bit ADC reading a slow sine wave with a little noise.
+        srand(1);
+        for (int i = 0; i < 100000; i++)
+            x.push_back((int16_t)(512 + 300 * sin(i / 200.0) + rand() % 5 - 2));
+    }
+    if (x.empty()) {fprintf(stderr, "no samples\n"); return 1;}
+
+    using clock = std::chrono::steady_clock;
+    const int repeats = 20;
+
+    std::vector<uint8_t> enc;
+    auto t0 = clock::now();
+    for (int r = 0; r < repeats; r++) {enc.clear(); encode(x.data(), x.size(), enc);}
+    auto t1 = clock::now();
+
+    std::vector<int16_t> y(x.size());
+    size_t got = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        size_t pos = 0;
+        auto next = [&]() -> int {return (pos < enc.size())? enc[pos++] : -1;};
+        got = decode(next, y.data(), y.size());
+    }
+    auto t2 = clock::now();
+
+    bool same = (got == x.size()) && (memcmp(x.data(), y.data(), x.size() * 2) == 0);
+    double bytesPerSample = (double)enc.size() / x.size();
+    double ns = 1e9 / (repeats * (double)x.size());
+
+    printf("samples            %zu\n", x.size());
+    printf("raw bytes          %zu\n", x.size() * 2);
+    printf("encoded bytes      %zu\n", enc.size());
+    printf("bytes per sample   %.3f\n", bytesPerSample);
+    printf("compression ratio  %.2f\n", 2.0 / bytesPerSample);
+    printf("samples/s at %lu baud: %.0f raw, %.0f encoded\n", baud,
+           baud / 10.0 / 2.0, baud / 10.0 / bytesPerSample);
+    printf("encode  %.1f ns/sample (this PC)\n",
+           std::chrono::duration<double>(t1 - t0).count() * ns);
+    printf("decode  %.1f ns/sample (this PC)\n",
+           std::chrono::duration<double>(t2 - t1).count() * ns);
+    printf("round trip         %s\n", same? "OK" : "MISMATCH");
+    return same? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if ((argc >= 4) && (strcmp(argv[1], "decode") == 0))
+    {
+        if (strcmp(argv[2], "-") == 0)
+            return decodeMode("-", 0, strtoul(argv[3], 0, 10));
+        if (argc >= 5)
+            return decodeMode(argv[2], strtoul(argv[3], 0, 10), strtoul(argv[4], 0, 10));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "bench") == 0))
+    {
+        const char* path = (argc > 2)? argv[2] : 0;
+        unsigned long baud = (argc > 3)? strtoul(argv[3], 0, 10) : 115200;
+        return benchMode(path, baud);
+    }
+    fprintf(stderr, "usage: %s decode tty baud n | decode - n | bench [trace [baud]]\n", argv[0]);
+    return 2;
+}
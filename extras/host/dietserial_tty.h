@@ -0,0 +1,79 @@
+#ifndef DIETSERIAL_HOST_TTY_H
+#define DIETSERIAL_HOST_TTY_H
+
+// Linux host side helpers for talking to a DietSerial board: open a tty in
+// raw 8N1 mode at any baud rate, change the rate, and read with a timeout.
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+// Uses termios2 (BOTHER) so that rates like 250000 and 1000000 work with
+// USB serial adapters. Not <termios.h>: its struct termios clashes with
+// the kernel's <asm/termbits.h>.
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+
+namespace dietserial {
+
+inline bool setBaud(int fd, unsigned long baud)
+{
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) < 0) return false;
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    return ioctl(fd, TCSETS2, &tio) == 0;
+}
+
+// Open a tty (or pty) raw, 8N1, no flow control. Returns -1 on failure.
+inline int openTty(const char* path, unsigned long baud)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {perror(path); return -1;}
+
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) < 0) {perror("TCGETS2"); close(fd); return -1;}
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL;
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(fd, TCSETS2, &tio) < 0) {perror("TCSETS2"); close(fd); return -1;}
+    // A pty has no baud rate; ignore failure there.
+    setBaud(fd, baud);
+    return fd;
+}
+
+// Wait until everything written has left the UART (tcdrain).
+inline void drain(int fd) {ioctl(fd, TCSBRK, 1);}
+
+// Discard anything received but not yet read (tcflush TCIFLUSH).
+inline void discardInput(int fd) {ioctl(fd, TCFLSH, TCIFLUSH);}
+
+// Read one byte, waiting up to timeoutMs. Returns -1 on timeout or error.
+inline int readByte(int fd, int timeoutMs)
+{
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, timeoutMs) <= 0) return -1;
+    uint8_t b;
+    if (read(fd, &b, 1) != 1) return -1;
+    return b;
+}
+
+inline bool writeByte(int fd, uint8_t b)
+{
+    return write(fd, &b, 1) == 1;
+}
+
+} // namespace dietserial
+
+#endif
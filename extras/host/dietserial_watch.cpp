@@ -0,0 +1,137 @@
+// dietserial_watch: decode DietSerial.telemetryTick() watch-list frames.
+//
+// Keeps the latest value of every watched variable, and prints the whole
+// set on one line each time a frame of changes arrives:-
+//   count=42 temperature=21.5 state=0x03
+// Text the board prints in between frames is ignored.
+//
+//   g++ -O2 -o dietserial_watch dietserial_watch.cpp
+//   ./dietserial_watch /dev/ttyUSB0 [baud]
+//   ./dietserial_watch - < capture.bin
+//
+// The frame format is described in src/DietSerial.cpp, above telemetryBegin().
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dietserial_tty.h"
+
+using namespace dietserial;
+
+static const uint8_t TelemetryMarker = 0xFD;
+
+struct Variable
+{
+    std::string          name;
+    char                 kind;
+    uint8_t              size;
+    std::vector<uint8_t> value;
+};
+
+// Buffered byte reader. next() returns -1 at end of input.
+static int     inFd = 0;
+static uint8_t inBuf[4096];
+static ssize_t inLen = 0;
+static ssize_t inPos = 0;
+
+static int next()
+{
+    if (inPos == inLen)
+    {
+        inLen = read(inFd, inBuf, sizeof(inBuf));
+        inPos = 0;
+        if (inLen <= 0) return -1;
+    }
+    return inBuf[inPos++];
+}
+
+static void printValue(const Variable& v)
+{
+    // Little-endian, as the board stores it.
+    uint64_t raw = 0;
+    for (int i = v.size - 1; i >= 0; i--) raw = (raw << 8) | v.value[i];
+
+    if ((v.kind == 'f') && (v.size == 4))
+    {
+        float f;
+        uint32_t r32 = (uint32_t)raw;
+        memcpy(&f, &r32, 4);
+        printf("%g", f);
+    }
+    else if ((v.kind == 'i') && (v.size <= 8))
+    {
+        int shift = 64 - 8 * v.size;
+        printf("%lld", (long long)(raw << shift) >> shift);    // sign-extend.
+    }
+    else if ((v.kind == 'u') && (v.size <= 8))
+    {
+        printf("%llu", (unsigned long long)raw);
+    }
+    else
+    {
+        printf("0x");
+        for (int i = v.size - 1; i >= 0; i--) printf("%02x", v.value[i]);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s tty|- [baud]\n", argv[0]);
+        return 2;
+    }
+    if (strcmp(argv[1], "-") != 0)
+    {
+        unsigned long baud = (argc > 2)? strtoul(argv[2], 0, 10) : 9600;
+        inFd = openTty(argv[1], baud);
+        if (inFd < 0) return 1;
+    }
+
+    std::vector<Variable> vars;
+    int c;
+    while ((c = next()) >= 0)
+    {
+        if (c != TelemetryMarker) continue;     // text between frames.
+        int type = next();
+
+        if (type == 'N')
+        {
+            int count = next();
+            if (count < 0) break;
+            vars.assign(count, Variable());
+            for (auto& v : vars)
+            {
+                v.kind = (char)next();
+                v.size = (uint8_t)next();
+                v.value.assign(v.size, 0);
+                while (((c = next()) > 0)) v.name += (char)c;
+            }
+        }
+        else if ((type == 'T') && !vars.empty())
+        {
+            std::vector<uint8_t> mask((vars.size() + 7) / 8);
+            for (auto& m : mask) m = (uint8_t)next();
+            for (size_t i = 0; i < vars.size(); i++)
+            {
+                if (!(mask[i / 8] & (1 << (i % 8)))) continue;
+                for (auto& b : vars[i].value) b = (uint8_t)next();
+            }
+            for (size_t i = 0; i < vars.size(); i++)
+            {
+                printf("%s%s=", i? " " : "", vars[i].name.c_str());
+                printValue(vars[i]);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -8,6 +8,9 @@
 #include <math.h>          // For NAN.
 
 #include <avr/io.h>        // register name and bit name macros.
+#include <avr/eeprom.h>    // eeprom_read_byte for dumpEEPROM.
+#include <util/crc16.h>    // _crc_xmodem_update for receiveXmodem.
+#include <util/atomic.h>   // ATOMIC_BLOCK for telemetryTick and txBegin.
 
 #include "DietSerial.h"    // includes DietSerial_macros.h as well
 
@@ -18,6 +21,14 @@
 // =============================================================================
 // Main USART class begins.
 
+// Wait for the DietSerialAsync queue to be sent, so that its head and tail
+// indices are left equal, and blocking and queued output don't mix. Nothing
+// to wait for, and no cost but the test, if DietSerialAsync.h isn't used.
+static inline void txQueueWait(void)
+{
+    if (dietSerialAsyncWait) dietSerialAsyncWait();
+}
+
 void AVR_USART::begin(const unsigned long baudRequested)
 {
     timeout_seconds_ = 90;  // default timeout 90 seconds
@@ -26,6 +37,8 @@ void AVR_USART::begin(const unsigned long baudRequested)
 
     if (baud < 300 ) {baud = 300;}  // 16 MHz system clock can't go below 300.
 
+    txQueueWait();  // a queue cut off here would be sent again later.
+
     // turn on the peripheral and configure it for 8N1 and selected BAUD.
     PRR    &= ~(1<<PRUSART0);
 
@@ -35,28 +48,151 @@ void AVR_USART::begin(const unsigned long baudRequested)
     // UPM01, UPM00 = 0 -> No parity; USBS = 0 -> 1 stop bit.
     // UCPOL0 = 0 -> normal polarity.
 
+    setBaud(baud);
+
+    //Enable transmit and receive; disable interrupts.
+    UCSR0B &= ~((1<<RXCIE0) | (1<<TXCIE0) | (1<<UDRIE0) | (1<<UCSZ02));
+    UCSR0B |= (1<<RXEN0) | (1<<TXEN0);
+}
+
+void AVR_USART::end(void)
+{
+    txQueueWait();
+    UCSR0B = 0;             // turn off RXEN0 and TXEN0.
+    PRR   |= 1<<PRUSART0;   // turn off the USART's clock.
+}
+
+// Baud rate register value for a baud rate. Sets use2x if U2X0 should be on.
+static uint16_t baudRegister(const unsigned long baud, bool& use2x)
+{
     uint16_t baudreg = ((F_CPU / 4 / baud) - 1) / 2;
+    use2x = true;
 
     if ((baudreg > 4095) || (baud == 57600 && F_CPU == 16000000UL))
     {
-        UCSR0A &= ~(1<<U2X0);   // not USE_2X
+        use2x = false;          // not USE_2X
         baudreg = ((F_CPU / 8 / baud) -1) / 2; // re-calculate registers.
-
     }
-    else {UCSR0A |= (1<<U2X0);} // USE_2X except in the case above.
+    return baudreg;
+}
+
+// Baud rate produced by a baud rate register value.
+static unsigned long baudFromRegister(const uint16_t baudreg, const bool use2x)
+{
+    return F_CPU / (use2x? 8 : 16) / (baudreg + 1UL);
+}
+
+void AVR_USART::setBaud(const unsigned long baud)
+{
+    bool use2x;
+    uint16_t baudreg = baudRegister(baud, use2x);
+
+    if (use2x)  {UCSR0A |= (1<<U2X0);}  // USE_2X except in the case above.
+    else        {UCSR0A &= ~(1<<U2X0);}
 
     UBRR0H = (uint8_t)(baudreg >> 8);
     UBRR0L = (uint8_t)baudreg;
+}
 
-    //Enable transmit and receive; disable interrupts.
-    UCSR0B &= ~((1<<RXCIE0) | (1<<TXCIE0) | (1<<UDRIE0) | (1<<UCSZ02));
-    UCSR0B |= (1<<RXEN0) | (1<<TXEN0);
+unsigned long AVR_USART::getBaud(void)
+{
+    uint16_t baudreg = ((uint16_t)(UBRR0H & 0x0f) << 8) | UBRR0L;
+    return baudFromRegister(baudreg, (UCSR0A & (1<<U2X0)));
 }
 
-void AVR_USART::end(void)
+// =============================================================================
+// Baud rate negotiation.
+//
+// Protocol, all bytes 8N1:-
+// 1. At the current rate we send ENQ (0x05) and the proposed baud rate as a
+//    binary long, as write(long) does: 4 bytes, least significant first.
+// 2. The host helper answers ACK (0x06) if it can use that rate, or NAK (0x15)
+//    if it can't; then we propose the next lower rate.
+// 3. After ACK both ends switch. The host sends the 8-byte test pattern
+//    below, we echo each byte back. If the host received the whole pattern
+//    back intact it sends ACK at the new rate.
+// 4. If either end sees a wrong byte or a timeout it stops sending and goes
+//    back to the old rate. We wait for the line to go quiet first, so that
+//    the host has also given up before we send the next ENQ.
+// No answer at step 2 means no host helper: we stay at the current rate.
+
+static const uint8_t BaudENQ = 0x05;
+static const uint8_t BaudACK = 0x06;
+
+static const unsigned long BaudCandidates[] PROGMEM =
+    {1000000UL, 500000UL, 250000UL, 125000UL, 76800UL, 57600UL, 38400UL,
+     19200UL};
+
+static const uint8_t BaudTestPattern[] PROGMEM =
+    {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x80, 0x01};
+
+unsigned long AVR_USART::negotiateBaud(const unsigned long maxBaud)
 {
-    UCSR0B = 0;             // turn off RXEN0 and TXEN0.
-    PRR   |= 1<<PRUSART0;   // turn off the USART's clock.
+    const uint8_t savedTimeout = timeout_seconds_;
+    timeout_seconds_ = 2;   // a host helper answers at once, or not at all.
+
+    const unsigned long oldBaud = getBaud();
+    unsigned long result = oldBaud;
+
+    for (auto& c : BaudCandidates)
+    {
+        const unsigned long candidate = pgm_read_dword(&c);
+        if ((candidate > maxBaud) || (candidate <= oldBaud)) continue;
+        if (candidate > F_CPU / 8) continue;  // faster than the USART can go.
+
+        // Skip rates more than 2 % off at this clock frequency.
+        bool use2x;
+        unsigned long actual = baudFromRegister(baudRegister(candidate, use2x),
+                                                use2x);
+        unsigned long diff = (actual > candidate)? actual - candidate
+                                                 : candidate - actual;
+        if (diff > candidate / 50) continue;
+
+        write(BaudENQ);
+        write((long)candidate);
+        uint8_t reply = readByte();
+        if (receive_err_ == 1) break;   // no host helper listening.
+        if (receive_err_ || (reply != BaudACK)) continue;  // NAK: next rate.
+
+        if (switchBaud(candidate)) {result = candidate; break;}
+    }
+
+    timeout_seconds_ = savedTimeout;
+    return result;
+}
+
+// Switch to newBaud and run the echo test. Restore the old rate on failure.
+bool AVR_USART::switchBaud(const unsigned long newBaud)
+{
+    const uint8_t oldUBRR0H = UBRR0H;
+    const uint8_t oldUBRR0L = UBRR0L;
+    const uint8_t oldU2X0   = UCSR0A & (1<<U2X0);
+
+    // The host has already received everything we sent, so the transmitter
+    // is idle: changing the rate now loses nothing.
+    setBaud(newBaud);
+
+    bool ok = true;
+    for (auto& p : BaudTestPattern)
+    {
+        uint8_t b = readByte();
+        if (receive_err_ || (b != pgm_read_byte(&p))) {ok = false; break;}
+        write(b);
+    }
+    if (ok)
+    {
+        uint8_t confirm = readByte();
+        ok = ((receive_err_ == 0) && (confirm == BaudACK));
+    }
+    if (ok) return true;
+
+    // Wait for the line to go quiet, then fall back.
+    waitQuiet();
+    flush();
+    UCSR0A = (UCSR0A & ~(1<<U2X0)) | oldU2X0;
+    UBRR0H = oldUBRR0H;
+    UBRR0L = oldUBRR0L;
+    return false;
 }
 
 // =============================================================================
@@ -66,19 +202,19 @@ void AVR_USART::end(void)
 void    AVR_USART::printError(rxerr_t err)
 {
     if (err) print(F("DietSerial: "));
-    if (err == 1) print(F("error 1, Receive timed out."));
-    if (err == 2) print(F("error 2, Data is garbled. Discard the character."));
-    if (err == 4) print(F("error 4, Other type of error."));
-    if (err == 8) print(F("error 8, The supplied buffer is too small. (CR-LF not received.)"));
+    if (err & 1)  print(F("error 1, Receive timed out. "));
+    if (err & 2)  print(F("error 2, Data is garbled. Discard the character. "));
+    if (err & 4)  print(F("error 4, Other type of error. "));
+    if (err & 8)  print(F("error 8, The supplied buffer is too small. (CR-LF not received.) "));
+    if (err & 16) print(F("error 16, Data overrun: bytes were lost. "));
 }
 
 // Main receive-a-byte function.
 // ============================
 
-uint8_t AVR_USART::readByte(void)
+// If there was a data overrun, clear the USART's FIFO.
+static inline void clearOverrun(void)
 {
-    receive_err_ = 0;        // Optimism: Assume no error.
-    // If there was a data overrun, clear the USART's FIFO first.
     if (UCSR0A & (1<<DOR0))
     {
         do
@@ -86,6 +222,12 @@ uint8_t AVR_USART::readByte(void)
         while (UCSR0A & (1<<RXC0));
         UCSR0A &= ~(1<<DOR0);   // Reset data overrun flag.
     }
+}
+
+uint8_t AVR_USART::readByte(void)
+{
+    receive_err_ = 0;        // Optimism: Assume no error.
+    clearOverrun();
 
     // If there is a byte ready, return it.
     // (Else) wait for a character to arrive.
@@ -136,6 +278,129 @@ size_t AVR_USART::readBytes(uint8_t* buf , const size_t bufLen)
     return i;
 }
 
+// readBytes() spends well over 100 cycles per byte in readByte(); at
+// 1 Mbaud a byte arrives every 160 cycles, at 2 Mbaud every 80. This loop
+// takes under 20 cycles per byte when bytes are waiting, so it keeps up
+// without assembler. The USART's error flags belong to the byte in UDR0
+// and must be read before it: collect them all and sort them out at the end.
+size_t AVR_USART::readBlock(uint8_t* buf, const size_t len)
+{
+    if (len == 0) {receive_err_ = 8; return 0;} // as readBytes().
+    receive_err_ = 0;
+    clearOverrun();
+    uint8_t* p = buf;
+    uint8_t* const end = buf + len;
+    uint8_t flags = 0;
+    WDTSecondTimer rxTimer;
+    rxTimer.reset();
+    while (p < end)
+    {
+        uint8_t status;
+        while (!((status = UCSR0A) & (1<<RXC0)))
+        {
+            if (rxTimer.tick() >= timeout_seconds_) {receive_err_ = 1; goto done;}
+        }
+        flags |= status;
+        *p++ = UDR0;
+        rxTimer.reset();                // the timeout is per byte.
+    }
+done:
+    if (flags & ((1<<FE0) | (1<<UPE0))) receive_err_ |= 2;
+    if (flags & (1<<DOR0))              receive_err_ |= 16;
+    return p - buf;
+}
+
+// Discard incoming bytes until none arrives for timeout_seconds_.
+void AVR_USART::waitQuiet(void)
+{
+    do {readByte();} while (receive_err_ != 1);
+}
+
+// XMODEM-CRC receiver.
+// ====================
+// 'C' asks the sender for CRC mode, then each block is
+// SOH, block number, 255 - block number, 128 data bytes, CRC-16 high, low.
+// EOT ends the transfer. NAK asks for the block again, CAN cancels.
+
+static const uint8_t XmodemSOH = 0x01;
+static const uint8_t XmodemEOT = 0x04;
+static const uint8_t XmodemACK = 0x06;
+static const uint8_t XmodemNAK = 0x15;
+static const uint8_t XmodemCAN = 0x18;
+static const uint8_t XmodemRetries = 10;
+static const size_t  XmodemBlockSize = 128;
+
+size_t AVR_USART::receiveXmodem(uint8_t* block, xmodemhandler_t handler)
+{
+    const uint8_t savedTimeout = timeout_seconds_;
+    size_t  blocks   = 0;
+    uint8_t expected = 1;           // block numbers start at 1, wrap at 255.
+    uint8_t retries  = 0;
+    uint8_t request  = 'C';         // 'C' until the first block, then NAK.
+    rxerr_t result   = 0;
+
+    write(request);
+    while (true)
+    {
+        timeout_seconds_ = 3;       // between blocks.
+        uint8_t c = readByte();
+        if (receive_err_ == 0)
+        {
+            if (c == XmodemEOT) {write(XmodemACK); break;}
+            if (c == XmodemCAN) {result = 4; break;}
+        }
+        if ((receive_err_ == 0) && (c == XmodemSOH))
+        {
+            timeout_seconds_ = 2;   // within a block.
+            uint8_t header[2];
+            uint8_t crcBytes[2];
+            readBytes(header, 2);
+            if (!receive_err_) readBytes(block, XmodemBlockSize);
+            if (!receive_err_) readBytes(crcBytes, 2);
+
+            uint16_t crc = 0;
+            if (!receive_err_)
+            {
+                for (size_t i = 0; i < XmodemBlockSize; i++)
+                    {crc = _crc_xmodem_update(crc, block[i]);}
+            }
+            if ((!receive_err_) && (header[0] == (uint8_t)~header[1])
+             && (crc == (((uint16_t)crcBytes[0] << 8) | crcBytes[1])))
+            {
+                if (header[0] == expected)
+                {
+                    if (!handler(block, blocks)) {result = 4; break;}
+                    ++blocks;
+                    ++expected;
+                    retries = 0;
+                    request = XmodemNAK;
+                    write(XmodemACK);
+                    continue;
+                }
+                if (header[0] == (uint8_t)(expected - 1))
+                {
+                    retries = 0;        // still making progress.
+                    write(XmodemACK);   // repeat: the sender missed our ACK.
+                    continue;
+                }
+                result = 4;             // out of sequence: can't recover.
+                break;
+            }
+        }
+
+        // Timeout, garbled byte, or bad block: let the sender finish, ask again.
+        if (++retries > XmodemRetries) {result = 1; break;}
+        timeout_seconds_ = 1;
+        waitQuiet();
+        write(request);
+    }
+
+    if (result) {write(XmodemCAN); write(XmodemCAN); write(XmodemCAN);}
+    timeout_seconds_ = savedTimeout;
+    receive_err_ = result;
+    return blocks;
+}
+
 int AVR_USART::readInt()
 {
     bytepair bp;
@@ -179,6 +444,227 @@ long   AVR_USART::readLong()
     return qb.l;
 }
 
+// Variable-length integers.
+// AVR has no barrel shifter, so a 32-bit shift by 7 is a loop of 28 single
+// bit shifts. The 7-bit groups are put together a byte at a time instead.
+
+unsigned long AVR_USART::readVarint()
+{
+    quadbyte qb;
+    qb.l = 0;
+    for (uint8_t k = 0; k < 5; k++)
+    {
+        uint8_t b = readByte();
+        if (receive_err_) return 0;
+        if ((k == 4) && (b & 0xf0)) break;  // more than 32 bits: garbled.
+
+        // Group k holds bits 7k to 7k+6: byte 7k/8, from bit 7k%8 upwards.
+        uint8_t  i = (7 * k) >> 3;
+        uint16_t g = (uint16_t)(b & 0x7f) << ((7 * k) & 7);
+        qb.b[i] |= (uint8_t)g;
+        if (i < 3) qb.b[i + 1] |= (uint8_t)(g >> 8);
+
+        if (!(b & 0x80)) return (unsigned long)qb.l;
+    }
+    receive_err_ = 2;
+    return 0;
+}
+
+long AVR_USART::readSignedVarint()
+{
+    unsigned long u = readVarint();
+    return (u & 1)? ~(long)(u >> 1) : (long)(u >> 1);   // undo zigzag
+}
+
+// Delta-encoded sample blocks, see writeSamples() for the format.
+
+size_t AVR_USART::readSamples(int16_t* buf, const size_t n)
+{
+    if (n == 0) {receive_err_ = 8; return 0;}
+
+    // Resynchronise: discard everything up to the start marker.
+    uint8_t b;
+    do
+    {
+        b = readByte();
+        if (receive_err_) return 0;
+    }
+    while (b != 0xFF);
+
+    int16_t prev = 0;
+    size_t  i = 0;
+    while (i < n)
+    {
+        uint8_t t = readByte();
+        if (receive_err_) return i;
+
+        if (t < 0x80)                       // one delta, 7 bits
+        {
+            prev += (t & 0x40)? (int16_t)(t | 0xff80) : t;
+            buf[i++] = prev;
+            continue;
+        }
+        if (t < 0xC0)                       // two deltas, 3 bits each
+        {
+            int8_t d1 = (t >> 3) & 7;
+            int8_t d2 = t & 7;
+            if (d1 & 4) d1 |= 0xf8;
+            if (d2 & 4) d2 |= 0xf8;
+            if (i + 2 > n) break;
+            prev += d1; buf[i++] = prev;
+            prev += d2; buf[i++] = prev;
+            continue;
+        }
+        if (t == 0xFF) break;               // unexpected start of a block.
+
+        uint8_t t2 = readByte();
+        if (receive_err_) return i;
+        if (t2 & 0x80) break;
+
+        if (t < 0xE0)                       // one delta, 12 bits
+        {
+            uint16_t v = ((uint16_t)(t & 0x1f) << 7) | t2;
+            if (v & 0x0800) v |= 0xf000;
+            prev += (int16_t)v;
+            buf[i++] = prev;
+        }
+        else if (t < 0xF0)                  // absolute value
+        {
+            uint8_t t3 = readByte();
+            if (receive_err_) return i;
+            if (t3 & 0x80) break;
+            uint8_t hi = (t2 >> 1) | (t << 6);
+            uint8_t lo = t3 | (t2 << 7);
+            prev = (int16_t)(((uint16_t)hi << 8) | lo);
+            buf[i++] = prev;
+        }
+        else if (t < 0xF8)                  // run of unchanged samples
+        {
+            size_t r = (((uint16_t)(t & 0x07) << 7) | t2) + 1;
+            if (i + r > n) break;
+            while (r--) {buf[i++] = prev;}
+        }
+        else break;                         // reserved
+    }
+    if (i < n) receive_err_ = 2;
+    return i;
+}
+
+
+// Command dispatcher.
+// ===================
+// The command table is in alphabetical order, so the commands that start
+// with the characters received so far are always next to each other: a trie
+// flattened into a sorted array. Each character narrows that range with two
+// binary searches, and there is no need to keep the command name.
+
+static char commandChar(const command_t* commands, const uint8_t i,
+                        const uint8_t pos)
+{
+    return (char)pgm_read_byte(&commands[i].name[pos]);
+}
+
+static bool isSeparator(const char c)
+{
+    return ((c == ' ') || (c == ',') || (c == '\t'));
+}
+
+void AVR_USART::skipLine(char c)
+{
+    while (!receive_err_ && !endOfLine(c)) {c = read();}
+}
+
+// Read one argument into buf. Returns the character that ended it.
+char AVR_USART::readField(char* buf, const size_t bufLen)
+{
+    char c;
+    do {c = read();} while (!receive_err_ && isSeparator(c));
+
+    size_t i = 0;
+    while (!receive_err_ && !isSeparator(c) && (c != '\r') && (c != '\n')
+           && (c != '\0'))
+    {
+        if (i < bufLen - 1) buf[i++] = c;
+        c = read();
+    }
+    buf[i] = '\0';
+    return c;
+}
+
+bool AVR_USART::dispatch(const command_t* commands, const uint8_t count)
+{
+    receive_err_ = 0;
+    uint8_t lo = 0;         // commands[lo..hi-1] match so far.
+    uint8_t hi = count;
+    uint8_t pos = 0;
+    char    c;
+
+    do {c = read();} while (!receive_err_ && isSeparator(c));
+    while (true)
+    {
+        if (receive_err_) return false;
+        if (isSeparator(c) || (c == '\r') || (c == '\n') || (c == '\0'))
+            break;
+
+        if (pos >= sizeof(commands[0].name) - 1) {lo = hi; break;}
+
+        uint8_t a = lo, b = hi;     // first entry with character >= c
+        while (a < b)
+        {
+            uint8_t m = (a + b) >> 1;
+            if (commandChar(commands, m, pos) < c) a = m + 1; else b = m;
+        }
+        lo = a;
+        b = hi;                     // first entry with character > c
+        while (a < b)
+        {
+            uint8_t m = (a + b) >> 1;
+            if (commandChar(commands, m, pos) <= c) a = m + 1; else b = m;
+        }
+        hi = a;
+        ++pos;
+        c = read();
+    }
+
+    // The exact match, if any, sorts first: it ends where the others go on.
+    if ((pos == 0) || (lo >= hi) || commandChar(commands, lo, pos))
+    {
+        skipLine(c);
+        receive_err_ = 4;   // unknown command.
+        return false;
+    }
+
+    bool eol = !isSeparator(c);     // the line ended with the name.
+    if (c == '\r') readByte();      // and the LF.
+
+    quadbyte args[4];
+    const char* spec = commands[lo].args;
+    uint8_t n = 0;
+    char    kind;
+    while ((n < 4) && ((kind = (char)pgm_read_byte(&spec[n])) != '\0'))
+    {
+        if (eol) {receive_err_ = 4; return false;}  // too few arguments.
+
+        char field[16];
+        c = readField(field, sizeof(field));
+        if (receive_err_) return false;
+        eol = !isSeparator(c);
+        if (c == '\r') readByte();
+        if (field[0] == '\0') {receive_err_ = 4; return false;}
+
+        if (kind == 'f') args[n].f = (float)atof(field);
+        else             args[n].l = atol(field);
+        ++n;
+    }
+    if (!eol) skipLine(c);          // ignore extra arguments.
+    if (receive_err_) return false;
+
+    commandhandler_t handler =
+        (commandhandler_t)pgm_read_ptr(&commands[lo].handler);
+    handler(args);
+    return true;
+}
+
 
 // Read ASCII.
 // ==========
@@ -300,6 +786,102 @@ size_t AVR_USART::readStringExcept(char* buf, const size_t bufLen,
     else {buf[i] = 0; return --i;}
 }
 
+size_t AVR_USART::readUntil(char* buf, const size_t bufLen, const char delimiter)
+{
+    if (bufLen == 0) {receive_err_ = 8; return 0;} // error: buffer too short
+
+    size_t i = 0;
+    while (i < bufLen - 1)
+    {
+        char c = read();
+        if (receive_err_) break;
+        if (c == delimiter) {buf[i] = '\0'; return i;}
+        buf[i++] = c;
+    }
+    buf[i] = '\0';
+    if (!receive_err_) receive_err_ = 8;  // buffer too small.
+    return i;
+}
+
+// Searching incoming data for a token.
+// ====================================
+// Knuth-Morris-Pratt matching, one byte at a time as they arrive. Instead
+// of a table of fall-back positions, which would need RAM for each token,
+// a fall-back is worked out from the token itself when a byte doesn't match.
+// Tokens are short, so that costs little, and needs no memory.
+
+static char tokenChar(const char* token, const bool flash, const uint8_t i)
+{
+    return flash? (char)pgm_read_byte(&token[i]) : token[i];
+}
+
+// Length of the longest proper prefix of token[0..q-1] that is also a suffix.
+static uint8_t tokenBorder(const char* token, const bool flash, const uint8_t q)
+{
+    for (uint8_t k = q - 1; k > 0; k--)
+    {
+        uint8_t j = 0;
+        while ((j < k) && (tokenChar(token, flash, j)
+                        == tokenChar(token, flash, q - k + j))) {++j;}
+        if (j == k) return k;
+    }
+    return 0;
+}
+
+// Matched q characters of token; c arrives. How many are matched now?
+static uint8_t tokenAdvance(const char* token, const bool flash, uint8_t q,
+                            const char c)
+{
+    while (true)
+    {
+        if (tokenChar(token, flash, q) == c) return q + 1;
+        if (q == 0) return 0;
+        q = tokenBorder(token, flash, q);
+    }
+}
+
+bool AVR_USART::findIn(const char* token, const char* terminator,
+                       const bool flash)
+{
+    receive_err_ = 0;
+    if (!token || !tokenChar(token, flash, 0)) return true;  // empty token.
+    if (terminator && !tokenChar(terminator, flash, 0)) terminator = 0;
+
+    uint8_t q = 0;      // characters of token matched so far.
+    uint8_t t = 0;      // characters of terminator matched so far.
+    while (true)
+    {
+        char c = read();
+        if (receive_err_) return false;
+
+        q = tokenAdvance(token, flash, q, c);
+        if (!tokenChar(token, flash, q)) return true;
+
+        if (terminator)
+        {
+            t = tokenAdvance(terminator, flash, t, c);
+            if (!tokenChar(terminator, flash, t)) return false;
+        }
+    }
+}
+
+bool AVR_USART::find(const char* token)
+    {return findIn(token, 0, false);}
+
+bool AVR_USART::find(const __FlashStringHelper* token)
+    {return findIn(reinterpret_cast<const char*>(token), 0, true);}
+
+bool AVR_USART::findUntil(const char* token, const char* terminator)
+    {return findIn(token, terminator, false);}
+
+bool AVR_USART::findUntil(const __FlashStringHelper* token,
+                          const __FlashStringHelper* terminator)
+{
+    return findIn(reinterpret_cast<const char*>(token),
+                  reinterpret_cast<const char*>(terminator), true);
+}
+
+
 // extracting numbers from incoming lines of text.
 
 double AVR_USART::parseFloat(const LookaheadMode mode, const char ignore)
@@ -379,37 +961,197 @@ long   AVR_USART::parseInt(char* buf, const size_t bufLen)
     else       return 0;
 }
 
+// Base64 and Ascii85 text back to binary.
+// Both decoders read one line, as readString() does, and write the bytes
+// straight into buf as soon as each is complete.
+
+// Value of a Base64 character 0..63, or 0xff if it is not one.
+static uint8_t base64Value(const char c)
+{
+    if ((c >= 'A') && (c <= 'Z')) return c - 'A';
+    if ((c >= 'a') && (c <= 'z')) return c - 'a' + 26;
+    if ((c >= '0') && (c <= '9')) return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return 0xff;
+}
+
+// True at end of line. Also removes the LF after a CR.
+bool AVR_USART::endOfLine(const char c)
+{
+    if (c == '\r') {readByte(); return true;}
+    return ((c == '\n') || (c == '\0'));
+}
+
+size_t AVR_USART::readBase64(void* buf, const size_t bufLen)
+{
+    if (bufLen == 0) {receive_err_ = 8; return 0;} // error: buffer too short
+
+    uint8_t* out  = (uint8_t*)buf;
+    size_t   i    = 0;
+    uint16_t bits = 0;      // at most 13 bits waiting to make a whole byte.
+    uint8_t  nbits = 0;
+
+    while (true)
+    {
+        char c = read();
+        if (receive_err_ || endOfLine(c)) return i;
+        if (c == '=') continue;     // padding: leftover bits are discarded.
+
+        uint8_t v = base64Value(c);
+        if (v == 0xff) {receive_err_ = 2; return i;}
+
+        bits = (bits << 6) | v;
+        nbits += 6;
+        if (nbits >= 8)
+        {
+            nbits -= 8;
+            if (i >= bufLen) {receive_err_ = 8; return i;}
+            out[i++] = (uint8_t)(bits >> nbits);
+        }
+    }
+}
+
+// group = group * 85 + d; false if that is more than 32 bits ("s8W-!" is
+// the largest group).
+static bool base85Digit(uint32_t& group, const uint8_t d)
+{
+    if (group > (0xFFFFFFFFUL - d) / 85) return false;
+    group = group * 85 + d;
+    return true;
+}
+
+size_t AVR_USART::readBase85(void* buf, const size_t bufLen)
+{
+    if (bufLen == 0) {receive_err_ = 8; return 0;} // error: buffer too short
+
+    uint8_t* out   = (uint8_t*)buf;
+    size_t   i     = 0;
+    uint32_t group = 0;
+    uint8_t  count = 0;     // characters in this group so far.
+    bool     done  = false;
+
+    while (!done)
+    {
+        char c = read();
+        if (receive_err_) return i;
+
+        uint8_t bytes = 4;   // bytes to store from this group.
+        if (endOfLine(c))
+        {
+            if (count == 0) return i;
+            if (count == 1) {receive_err_ = 2; return i;}
+            bytes = count - 1;                  // partial last group:
+            while (count < 5)                   // pad with 'u'.
+            {
+                if (!base85Digit(group, 84)) {receive_err_ = 2; return i;}
+                ++count;
+            }
+            done  = true;
+        }
+        else if ((c == 'z') && (count == 0))
+        {
+            count = 5;                          // group = 0.
+        }
+        else if ((c >= '!') && (c <= 'u'))
+        {
+            if (!base85Digit(group, c - '!')) {receive_err_ = 2; return i;}
+            ++count;
+        }
+        else {receive_err_ = 2; return i;}
+
+        if (count < 5) continue;
+
+        quadbyte qb;
+        qb.l = group;
+        for (int8_t k = 3; k >= 4 - bytes; k--)     // most significant first.
+        {
+            if (i >= bufLen) {receive_err_ = 8; return i;}
+            out[i++] = qb.b[k];
+        }
+        group = 0;
+        count = 0;
+    }
+    return i;
+}
+
 //==============================================================================
 //
 // Transmit.
 //
 
-void AVR_USART::txRaw(const uint8_t b)
-    {UDR0 = b;}
+// Each public write() and print() sends its bytes in three steps:-
+// txBegin() once: waits for the DietSerialAsync queue and, with
+// DietSerialPower.h, switches the USART on if it has switched itself off
+// (a switched-off USART's registers can't be read or written). It also
+// holds off the switch-off interrupt until the last byte, so that a pause
+// between bytes can't switch the USART off part way through. Returns the
+// TXCIE0 bit to put back, 0 if DietSerialPower isn't in use.
+// txByte() for every byte but the last: just the wait for room.
+// txLast() for the last byte: after it is in UDR0, TXC0 can only come from
+// it, so any TXC0 left from a pause is cleared before the interrupt is
+// allowed again.
+
+static inline uint8_t txBegin(void)
+{
+    txQueueWait();
+    if (!dietSerialPowerOn) return 0;
+    uint8_t hold;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (PRR & (1<<PRUSART0)) dietSerialPowerOn();
+        hold = UCSR0B & (1<<TXCIE0);
+        UCSR0B &= ~(1<<TXCIE0);
+    }
+    return hold;
+}
 
-void AVR_USART::write(const uint8_t b)
+static inline void txByte(const uint8_t b)
 {
     loop_until_bit_is_set(UCSR0A, UDRE0); // wait till prev tx complete.
     UDR0 = b;
 }
 
-void AVR_USART::write(const uint8_t* buf, const size_t numBytes)
+static inline void txLast(const uint8_t b, const uint8_t hold)
 {
-    if (!(buf) || (numBytes == 0)) return;
-    for (size_t i = 0; i < numBytes; i++)
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    if (!hold) {UDR0 = b; return;}
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        loop_until_bit_is_set(UCSR0A, UDRE0);
-        UDR0 = buf[i];
+        UDR0 = b;
+        UCSR0A  = (UCSR0A & ((1<<U2X0) | (1<<MPCM0))) | (1<<TXC0);
+        UCSR0B |= hold;
     }
 }
 
-// Binary data types
-void AVR_USART::write(const char c)
+void AVR_USART::txRaw(const uint8_t b)
 {
-    loop_until_bit_is_set(UCSR0A, UDRE0);
-    UDR0 = (uint8_t)c;
+    if (!dietSerialPowerOn) {UDR0 = b; return;}
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (PRR & (1<<PRUSART0)) dietSerialPowerOn();
+        UDR0 = b;
+    }
+}
+
+void AVR_USART::write(const uint8_t b)
+{
+    const uint8_t hold = txBegin();
+    txLast(b, hold);
+}
+
+void AVR_USART::write(const uint8_t* buf, const size_t numBytes)
+{
+    if (!(buf) || (numBytes == 0)) return;
+    const uint8_t hold = txBegin();
+    for (size_t i = 0; i < numBytes - 1; i++) txByte(buf[i]);
+    txLast(buf[numBytes - 1], hold);
 }
 
+// Binary data types
+void AVR_USART::write(const char c)
+    {write((uint8_t)c);}
+
 void AVR_USART::write4bytes(quadbyte& qb)
 {
     write(qb.b[0]);
@@ -439,10 +1181,112 @@ void AVR_USART::write(const long l)
   write4bytes((quadbyte&)l);
 }
 
+void AVR_USART::writeVarint(const unsigned long ul)
+{
+    quadbyte qb;
+    qb.l = (long)ul;
+
+    // 7-bit groups, least significant first, using 8-bit shifts only.
+    uint8_t g[5];
+    g[0] =   qb.b[0] & 0x7f;
+    g[1] = ((qb.b[0] >> 7) | (qb.b[1] << 1)) & 0x7f;
+    g[2] = ((qb.b[1] >> 6) | (qb.b[2] << 2)) & 0x7f;
+    g[3] = ((qb.b[2] >> 5) | (qb.b[3] << 3)) & 0x7f;
+    g[4] =   qb.b[3] >> 4;
+
+    uint8_t last = 4;
+    while (last && !g[last]) {--last;}
+    for (uint8_t k = 0; k < last; k++) {write((uint8_t)(g[k] | 0x80));}
+    write(g[last]);
+}
+
+void AVR_USART::writeVarint(const long l)
+{
+    // zigzag: small negative numbers become small positive ones.
+    unsigned long u = (unsigned long)l << 1;
+    writeVarint((l < 0)? ~u : u);
+}
+
+// Delta-encoded sample blocks.
+// =============================
+// 0xFF starts a block; it occurs nowhere else, so a receiver can always
+// resynchronise on it. The first sample follows as an absolute value, then
+// the differences between successive samples (16-bit, wrapping):-
+// 0ddddddd                     one difference, -64 .. 63
+// 10aaabbb                     two differences, -4 .. 3 each
+// 110ddddd 0ddddddd            one difference, -2048 .. 2047
+// 1110--hh 0hhhhhhh 0lllllll   absolute value, 16 bits
+// 11110rrr 0rrrrrrr            r + 1 unchanged samples, 1 .. 1024
+// 11111000 .. 11111110         reserved
+
+void AVR_USART::writeSampleValue(const int16_t v)
+{
+    const uint8_t hi = (uint16_t)v >> 8;
+    const uint8_t lo = v;
+    write((uint8_t)(0xE0 | (hi >> 6)));
+    write((uint8_t)(((hi << 1) | (lo >> 7)) & 0x7f));
+    write((uint8_t)(lo & 0x7f));
+}
+
+void AVR_USART::writeSamples(const int16_t* samples, const size_t n)
+{
+    if (!samples || (n == 0)) return;
+    write((uint8_t)0xFF);
+    writeSampleValue(samples[0]);
+
+    size_t i = 1;
+    while (i < n)
+    {
+        int16_t d = samples[i] - samples[i - 1];
+
+        if (d == 0)
+        {
+            size_t r = 1;
+            while ((i + r < n) && (r < 1024) && (samples[i + r] == samples[i]))
+                {++r;}
+            if (r >= 3)
+            {
+                --r;
+                write((uint8_t)(0xF0 | (r >> 7)));
+                write((uint8_t)(r & 0x7f));
+                i += r + 1;
+                continue;
+            }
+        }
+        if ((d >= -4) && (d <= 3) && (i + 1 < n))
+        {
+            int16_t d2 = samples[i + 1] - samples[i];
+            if ((d2 >= -4) && (d2 <= 3))
+            {
+                write((uint8_t)(0x80 | ((d & 7) << 3) | (d2 & 7)));
+                i += 2;
+                continue;
+            }
+        }
+        if ((d >= -64) && (d <= 63))
+        {
+            write((uint8_t)(d & 0x7f));
+        }
+        else if ((d >= -2048) && (d <= 2047))
+        {
+            write((uint8_t)(0xC0 | ((d >> 7) & 0x1f)));
+            write((uint8_t)(d & 0x7f));
+        }
+        else
+        {
+            writeSampleValue(samples[i]);
+        }
+        ++i;
+    }
+}
+
 // Bytes are in program memory (flash):-
 void AVR_USART::writeP(const uint8_t* data, const size_t numBytes)
 {
-    for (size_t i = 0; i < numBytes; i++) {write(pgm_read_byte(&data[i]));}
+    if (numBytes == 0) return;
+    const uint8_t hold = txBegin();
+    for (size_t i = 0; i < numBytes - 1; i++) {txByte(pgm_read_byte(&data[i]));}
+    txLast(pgm_read_byte(&data[numBytes - 1]), hold);
 }
 
 
@@ -451,9 +1295,11 @@ void AVR_USART::writeP(const uint8_t* data, const size_t numBytes)
 void AVR_USART::print(const char* string)
 // warning: Assumes string is properly terminated with a null 0 byte.
 {
-    if (!string) return;
+    if (!string || !string[0]) return;
+    const uint8_t hold = txBegin();
     register int i = 0;
-    while (string[i]) {write((uint8_t)string[i++]);}
+    while (string[i + 1]) {txByte((uint8_t)string[i++]);}
+    txLast((uint8_t)string[i], hold);
 }
 
 // warning: Assumes string is properly terminated with a null 0 byte
@@ -461,9 +1307,12 @@ void AVR_USART::print(const char* string)
 void AVR_USART::printP(const char * s_)
 {
     if (!s_) return;
-    size_t  i = 0;
-    uint8_t c;
-    while ((c = pgm_read_byte(&s_[i++])) != '\0') {write(c);}
+    uint8_t c = pgm_read_byte(s_);
+    if (c == '\0') return;
+    const uint8_t hold = txBegin();
+    uint8_t next;
+    while ((next = pgm_read_byte(++s_)) != '\0') {txByte(c); c = next;}
+    txLast(c, hold);
 }
 
 
@@ -488,7 +1337,12 @@ void AVR_USART::printBinary(const uint8_t b)
 
 // Least significant four bits 0 - F (hex)
 void AVR_USART::printDigit(uint8_t d)
-    {d &= 0x0f; write((d < 10)? (d + '0'): (d - 10 + 'a'));}
+    {d &= 0x0f; write((uint8_t)((d < 10)? (d + '0'): (d - 10 + 'a')));}
+
+
+// Two hex digits, leading zero included.
+void AVR_USART::printHex(const uint8_t b)
+    {printDigit(b >> 4); printDigit(b);}
 
 
 // 8-bit special types
@@ -554,6 +1408,399 @@ void AVR_USART::print(const __FlashStringHelper *fsh)
     printP(buf);
 }
 
+// -------------
+// Base64 and Ascii85.
+
+// Base64 character for 0..63, without a lookup table.
+static uint8_t base64Char(const uint8_t v)
+{
+    if (v < 26) return v + 'A';
+    if (v < 52) return v - 26 + 'a';
+    if (v < 62) return v - 52 + '0';
+    return (v == 62)? '+' : '/';
+}
+
+void AVR_USART::printBase64(const void* data, const size_t len)
+{
+    const uint8_t* in = (const uint8_t*)data;
+    uint16_t bits  = 0;     // at most 13 bits waiting to be sent.
+    uint8_t  nbits = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        bits = (bits << 8) | in[i];
+        nbits += 8;
+        while (nbits >= 6)
+        {
+            nbits -= 6;
+            write(base64Char((bits >> nbits) & 0x3f));
+        }
+    }
+    if (nbits) {write(base64Char((bits << (6 - nbits)) & 0x3f));}
+    // Pad to a multiple of 4 characters.
+    for (uint8_t pad = (3 - len % 3) % 3; pad; pad--) {write('=');}
+}
+
+// 85^4 .. 85^1: Ascii85 digits are sent most significant first.
+static const uint32_t Base85Powers[] PROGMEM = {52200625UL, 614125UL, 7225UL, 85UL};
+
+void AVR_USART::printBase85(const void* data, const size_t len)
+{
+    const uint8_t* in = (const uint8_t*)data;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        // Up to 4 bytes, most significant first, zero-padded.
+        uint8_t  n = (len - i < 4)? len - i : 4;
+        quadbyte qb;
+        qb.l = 0;
+        for (int8_t k = 3; k >= 4 - n; k--) {qb.b[k] = in[i++];}
+
+        uint32_t group = qb.l;
+        if ((n == 4) && (group == 0)) {write('z'); continue;}
+
+        // A partial group of n bytes is sent as its first n + 1 characters.
+        for (uint8_t k = 0; k <= n; k++)
+        {
+            uint8_t d = group;
+            if (k < 4)
+            {
+                uint32_t p = pgm_read_dword(&Base85Powers[k]);
+                d = group / p;
+                group -= d * p;
+            }
+            write((uint8_t)(d + '!'));
+        }
+    }
+}
+
+
+// -------------
+// Variable watch-list telemetry.
+//
+// Frames start with 0xFD and a type letter:-
+// 'N': count, then for each variable: kind, size, name, null.
+// 'T': a bitmask of (count + 7) / 8 bytes, bit 0 of the first byte for the
+//      first variable; then the new value of each variable whose bit is set,
+//      least significant byte first, as write() sends it.
+
+static const uint8_t TelemetryMarker = 0xFD;
+
+// Up to 32 variables (the change mask is 4 bytes), and room in the shadow
+// array for copies of all of them.
+static bool watchlistFits(const watchlist_t& list)
+{
+    if (list.count > 32) return false;
+    size_t total = 0;
+    for (uint8_t i = 0; i < list.count; i++)
+        {total += pgm_read_byte(&list.vars[i].size);}
+    return total <= list.shadowLen;
+}
+
+bool AVR_USART::telemetryBegin(const watchlist_t& list)
+{
+    if (!watchlistFits(list)) return false;
+
+    write(TelemetryMarker); write('N'); write(list.count);
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        write(pgm_read_byte(&list.vars[i].kind));
+        write(pgm_read_byte(&list.vars[i].size));
+        printP(list.vars[i].name);
+        write((uint8_t)0);
+    }
+    telemetrySend(list, true);
+    return true;
+}
+
+void AVR_USART::telemetryTick(const watchlist_t& list)
+    {telemetrySend(list, false);}
+
+void AVR_USART::telemetrySend(const watchlist_t& list, const bool all)
+{
+    if (!watchlistFits(list)) return;   // would overrun mask or shadow.
+
+    uint8_t mask[4] = {0};
+    bool    any = all;
+
+    // Pass 1: which variables differ from their copies?
+    uint8_t* copy = list.shadow;
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        const uint8_t* v = (const uint8_t*)pgm_read_ptr(&list.vars[i].addr);
+        const uint8_t size = pgm_read_byte(&list.vars[i].size);
+        bool changed = all;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)   // an ISR may be changing it.
+        {
+            for (uint8_t j = 0; j < size; j++)
+                {if (copy[j] != v[j]) changed = true;}
+        }
+        if (changed) {mask[i >> 3] |= (1 << (i & 7)); any = true;}
+        copy += size;
+    }
+    if (!any) return;
+
+    write(TelemetryMarker); write('T');
+    write(mask, (list.count + 7) >> 3);
+
+    // Pass 2: update the copies and send them.
+    copy = list.shadow;
+    for (uint8_t i = 0; i < list.count; i++)
+    {
+        const uint8_t* v = (const uint8_t*)pgm_read_ptr(&list.vars[i].addr);
+        const uint8_t size = pgm_read_byte(&list.vars[i].size);
+        if (mask[i >> 3] & (1 << (i & 7)))
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                for (uint8_t j = 0; j < size; j++) {copy[j] = v[j];}
+            }
+            write(copy, size);
+        }
+        copy += size;
+    }
+}
+
+
+// -------------
+// Memory dumps.
+
+enum {DUMP_RAM, DUMP_EEPROM, DUMP_FLASH};
+
+static uint8_t dumpRead(const uint8_t memory, const uint16_t addr)
+{
+    if (memory == DUMP_EEPROM) return eeprom_read_byte((const uint8_t*)addr);
+    if (memory == DUMP_FLASH)  return pgm_read_byte(addr);
+    return *(const uint8_t*)addr;
+}
+
+// Each byte is read twice, once for the hex and once for the ASCII column,
+// rather than keeping a 16-byte line buffer on the stack.
+void AVR_USART::dump(const uint8_t memory, uint16_t addr, size_t len,
+                     const bool raw)
+{
+    if (raw)
+    {
+        while (len--) {write(dumpRead(memory, addr++));}
+        return;
+    }
+    while (len)
+    {
+        const uint8_t lineLen = (len < 16)? len : 16;
+
+        printHex(addr >> 8); printHex(addr); space();
+        for (uint8_t i = 0; i < 16; i++)
+        {
+            if (i == 8) space();
+            space();
+            if (i < lineLen) printHex(dumpRead(memory, addr + i));
+            else             {space(); space();}  // keep the ASCII column lined up.
+        }
+        space(); space(); vbar();
+        for (uint8_t i = 0; i < lineLen; i++)
+        {
+            uint8_t c = dumpRead(memory, addr + i);
+            write((uint8_t)(((c < 0x20) || (c > 0x7e))? '.' : c));
+        }
+        vbar(); crlf();
+
+        addr += lineLen;
+        len  -= lineLen;
+    }
+}
+
+void AVR_USART::dumpHex(const void* addr, const size_t len, const bool raw)
+    {dump(DUMP_RAM, (uint16_t)addr, len, raw);}
+
+void AVR_USART::dumpEEPROM(const uint16_t addr, const size_t len, const bool raw)
+    {dump(DUMP_EEPROM, addr, len, raw);}
+
+void AVR_USART::dumpFlash(const void* addr, const size_t len, const bool raw)
+    {dump(DUMP_FLASH, (uint16_t)addr, len, raw);}
+
+
+// -------------
+// Stack painting.
+
+extern uint8_t __heap_start;    // avr-libc: end of .data and .bss.
+extern char*   __brkval;        // avr-libc: top of the malloc heap, or 0.
+
+static const uint8_t StackPaint = 0xC5;
+
+static uint8_t* stackBottom(void)
+    {return __brkval ? (uint8_t*)__brkval : &__heap_start;}
+
+// Only the bytes below the stack pointer are free; an interrupt during the
+// loop may overwrite some of them again, which is real stack use anyway.
+void AVR_USART::stackPaint(void)
+{
+    uint8_t* p = stackBottom();
+    uint8_t* const top = (uint8_t*)SP;
+    while (p < top) *p++ = StackPaint;
+}
+
+size_t AVR_USART::stackHighWater(void)
+{
+    const uint8_t* p = stackBottom();
+    while ((p <= (const uint8_t*)RAMEND) && (*p == StackPaint)) p++;
+    return (const uint8_t*)RAMEND + 1 - p;
+}
+
+
+// -------------
+// Loopback self-test.
+
+// The bytes are an 8-bit maximal-length LFSR sequence, so the receiving side
+// can regenerate what it expects without a buffer. Timer1 counts at F_CPU/8
+// (0.5 us at 16 MHz); its overflows are counted by polling TOV1, at least
+// every 32 ms, so no interrupt handler is needed.
+
+static const uint8_t  SelfTestLatencyBytes = 16;
+static const uint32_t SelfTestTimeout      = F_CPU / 8;    // 1 second.
+
+static uint8_t selfTestNext(const uint8_t x)
+    {return (x & 1)? (x >> 1) ^ 0xB8 : (x >> 1);}
+
+static uint32_t selfTestTicks(uint16_t& overflows)
+{
+    uint16_t t = TCNT1;
+    if (TIFR1 & (1<<TOV1))
+    {
+        TIFR1 = (1<<TOV1);      // clear by writing 1.
+        ++overflows;
+        t = TCNT1;              // in case it overflowed after the first read.
+    }
+    return ((uint32_t)overflows << 16) | t;
+}
+
+static uint16_t selfTestMicros(const uint32_t ticks)
+{
+    const uint32_t us = ticks * 8 / (F_CPU / 1000000UL);
+    return (us > 0xFFFF)? 0xFFFF : us;
+}
+
+// Check one received byte against the expected pattern and count errors.
+static void selfTestCheck(selftest_t& r, const uint8_t status,
+                          const uint8_t b, const uint8_t expected)
+{
+    if (status & ((1<<FE0) | (1<<UPE0))) ++r.garbled;
+    if (status & (1<<DOR0))              ++r.overruns;
+    if (b != expected)                   ++r.mismatched;
+}
+
+bool AVR_USART::selfTest(const unsigned long baud, const uint16_t bytes,
+                         selftest_t& result)
+{
+    result = selftest_t();
+
+    // DietSerialPower.h may have switched the USART off, and would switch it
+    // off again after every latency byte: switch it on, and hold its
+    // interrupt off until the end.
+    flush();
+    uint8_t oldTXCIE0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (dietSerialPowerOn && (PRR & (1<<PRUSART0))) dietSerialPowerOn();
+        oldTXCIE0 = UCSR0B & (1<<TXCIE0);
+        UCSR0B   &= ~(1<<TXCIE0);
+    }
+    const uint8_t oldUBRR0H = UBRR0H;
+    const uint8_t oldUBRR0L = UBRR0L;
+    const uint8_t oldU2X0   = UCSR0A & (1<<U2X0);
+    const uint8_t oldTCCR1A = TCCR1A;
+    const uint8_t oldTCCR1B = TCCR1B;
+
+    setBaud(baud);
+    result.baud = getBaud();
+    while (UCSR0A & (1<<RXC0)) {volatile uint8_t dummy __attribute__((unused)) = UDR0;}
+
+    TCCR1A = 0;
+    TCCR1B = (1<<CS11);         // normal mode, F_CPU / 8.
+    TCNT1  = 0;
+    TIFR1  = (1<<TOV1);
+    uint16_t overflows = 0;
+
+    uint8_t txPattern = 1;
+    uint8_t rxPattern = 1;
+    uint16_t received = 0;
+    uint32_t latencyTotal = 0;
+    result.latencyMin = 0xFFFF;
+
+    // Latency: one byte at a time.
+    for (uint8_t i = 0; i < SelfTestLatencyBytes; i++)
+    {
+        UDR0 = txPattern;
+        txPattern = selfTestNext(txPattern);
+        const uint32_t start = selfTestTicks(overflows);
+        uint32_t now;
+        do {now = selfTestTicks(overflows);}
+        while (!(UCSR0A & (1<<RXC0)) && (now - start < SelfTestTimeout));
+        if (!(UCSR0A & (1<<RXC0))) break;   // nothing is echoing.
+
+        const uint8_t status = UCSR0A;
+        selfTestCheck(result, status, UDR0, rxPattern);
+        rxPattern = selfTestNext(rxPattern);
+        ++received;
+
+        const uint16_t us = selfTestMicros(now - start);
+        latencyTotal += us;
+        if (us < result.latencyMin) result.latencyMin = us;
+        if (us > result.latencyMax) result.latencyMax = us;
+    }
+    if (received) result.latencyMean = latencyTotal / received;
+    else          result.latencyMin = 0;
+
+    // Throughput: send whenever the USART has room, receive as bytes arrive.
+    if (received == SelfTestLatencyBytes)
+    {
+        uint16_t sent = 0;
+        received = 0;
+        const uint32_t start = selfTestTicks(overflows);
+        uint32_t last = start;
+        while (received < bytes)
+        {
+            const uint32_t now = selfTestTicks(overflows);
+            if ((sent < bytes) && (UCSR0A & (1<<UDRE0)))
+            {
+                UDR0 = txPattern;
+                txPattern = selfTestNext(txPattern);
+                ++sent;
+            }
+            const uint8_t status = UCSR0A;
+            if (status & (1<<RXC0))
+            {
+                selfTestCheck(result, status, UDR0, rxPattern);
+                rxPattern = selfTestNext(rxPattern);
+                ++received;
+                last = now;
+            }
+            else if (now - last > SelfTestTimeout) break;
+        }
+        // received * ticks per second can overflow 32 bits: scale both
+        // down until it doesn't. No floating point, to save flash.
+        uint32_t ticks     = last - start;
+        uint32_t perSecond = F_CPU / 8;
+        while (received && (perSecond > 0xFFFFFFFFUL / received))
+            {perSecond >>= 1; ticks >>= 1;}
+        if (ticks) result.bytesPerSecond = (uint32_t)received * perSecond / ticks;
+        result.lost = bytes - received;
+    }
+    else result.lost = SelfTestLatencyBytes - received + bytes;
+
+    TCCR1B = oldTCCR1B;
+    TCCR1A = oldTCCR1A;
+    flush();
+    UCSR0A = (UCSR0A & ~(1<<U2X0)) | oldU2X0;
+    UBRR0H = oldUBRR0H;
+    UBRR0L = oldUBRR0L;
+    UCSR0B |= oldTXCIE0;    // TXC0 is set: DietSerialPower switches off now.
+
+    return !(result.mismatched || result.garbled || result.overruns
+             || result.lost);
+}
+
+
 // -------------
 // println()
 
@@ -636,5 +1883,281 @@ void AVR_USART::at()      {write('@');}
 void AVR_USART::vbar()    {write('|');}
 
 
+// =============================================================================
+// Logical channels.
+//
+// DLE n (n = 0-15) starts data on channel n; DLE DLE is a DLE in the data.
+// The numbers print() sends are digits, '-' and '.', never DLE, so only
+// strings, characters and binary data need escaping.
+//
+// The tag is sent only when the channel changes; untagged output, such as
+// DietSerial's own functions, stays on the channel the line is on. Channel 0
+// is tagged every time, so that a host that started listening late, or a
+// board that was reset, gets back onto it.
+
+static const uint8_t ChannelDLE = 0x10;
+
+static uint8_t channelOnLine = 0;   // as the host: channel 0 until a tag.
+
+void AVR_USART_Channel::tag(void)
+{
+    if (n && (n == channelOnLine)) return;
+    DietSerial.write(ChannelDLE);
+    DietSerial.write(n);
+    channelOnLine = n;
+}
+
+void AVR_USART_Channel::put(const uint8_t b)
+{
+    if (b == ChannelDLE) DietSerial.write(b);
+    DietSerial.write(b);
+}
+
+void AVR_USART_Channel::write(const uint8_t b)  {tag(); put(b);}
+void AVR_USART_Channel::write(const char c)     {tag(); put(c);}
+
+void AVR_USART_Channel::write(const uint8_t* buffer, const size_t numBytes)
+{
+    if (!buffer || (numBytes == 0)) return;
+    tag();
+    for (size_t i = 0; i < numBytes; i++) put(buffer[i]);
+}
+
+void AVR_USART_Channel::writeP(const uint8_t* buffer, const size_t numBytes)
+{
+    if (!buffer || (numBytes == 0)) return;
+    tag();
+    for (size_t i = 0; i < numBytes; i++) put(pgm_read_byte(buffer + i));
+}
+
+void AVR_USART_Channel::write(const int i)
+    {write((const uint8_t*)&i, sizeof(i));}
+void AVR_USART_Channel::write(const long l)
+    {write((const uint8_t*)&l, sizeof(l));}
+void AVR_USART_Channel::write(const float f)
+    {write((const uint8_t*)&f, sizeof(f));}
+void AVR_USART_Channel::write(const double d)
+    {write((const uint8_t*)&d, sizeof(d));}
+
+void AVR_USART_Channel::print(const char c) {write(c);}
+
+void AVR_USART_Channel::print(const char* s)
+{
+    if (!s) return;
+    tag();
+    while (*s) put(*s++);
+}
+
+void AVR_USART_Channel::printP(const char* s)
+{
+    if (!s) return;
+    tag();
+    char c;
+    while ((c = pgm_read_byte(s++))) put(c);
+}
+
+void AVR_USART_Channel::print(const __FlashStringHelper* fsh)
+    {printP(reinterpret_cast<const char*>(fsh));}
+
+void AVR_USART_Channel::print(const double d, const int decimals)
+    {tag(); DietSerial.print(d, decimals);}
+void AVR_USART_Channel::print(const float f, const int decimals)
+    {tag(); DietSerial.print(f, decimals);}
+void AVR_USART_Channel::print(const int i, const int base)
+    {tag(); DietSerial.print(i, base);}
+void AVR_USART_Channel::print(const long l, const int base)
+    {tag(); DietSerial.print(l, base);}
+void AVR_USART_Channel::print(const uint8_t ub, const int base)
+    {tag(); DietSerial.print(ub, base);}
+void AVR_USART_Channel::print(const unsigned int ui, const int base)
+    {tag(); DietSerial.print(ui, base);}
+void AVR_USART_Channel::print(const unsigned long ul, const int base)
+    {tag(); DietSerial.print(ul, base);}
+
+void AVR_USART_Channel::println(void)
+    {tag(); DietSerial.crlf();}
+
+// The CR-LF follows print() on the same channel: it needs no tag of its own.
+void AVR_USART_Channel::println(const char c)
+    {print(c); DietSerial.crlf();}
+void AVR_USART_Channel::println(const char* s)
+    {print(s); DietSerial.crlf();}
+void AVR_USART_Channel::println(const __FlashStringHelper* fsh)
+    {print(fsh); DietSerial.crlf();}
+void AVR_USART_Channel::printlnP(const char* s)
+    {printP(s); DietSerial.crlf();}
+void AVR_USART_Channel::println(const double d, const int decimals)
+    {print(d, decimals); DietSerial.crlf();}
+void AVR_USART_Channel::println(const float f, const int decimals)
+    {print(f, decimals); DietSerial.crlf();}
+void AVR_USART_Channel::println(const int i, const int base)
+    {print(i, base); DietSerial.crlf();}
+void AVR_USART_Channel::println(const long l, const int base)
+    {print(l, base); DietSerial.crlf();}
+void AVR_USART_Channel::println(const uint8_t ub, const int base)
+    {print(ub, base); DietSerial.crlf();}
+void AVR_USART_Channel::println(const unsigned int ui, const int base)
+    {print(ui, base); DietSerial.crlf();}
+void AVR_USART_Channel::println(const unsigned long ul, const int base)
+    {print(ul, base); DietSerial.crlf();}
+
+
+// ChannelDemux
+
+void ChannelDemux::receive(const uint8_t b)
+{
+    if (escape)
+    {
+        escape = false;
+        if (b != ChannelDLE) {current = b & 0x0F; return;}
+    }
+    else if (b == ChannelDLE) {escape = true; return;}
+
+    if (current >= count) return;
+    channelhandler_t handler =
+        (channelhandler_t)pgm_read_ptr(&handlers[current]);
+    if (handler) handler(b);
+}
+
+void ChannelDemux::poll(void)
+{
+    while (DietSerial.available())
+    {
+        uint8_t b = DietSerial.readByte();
+        if (!DietSerial.error()) receive(b);
+    }
+}
+
+// =============================================================================
+// Offline log in EEPROM.
+//
+// Slot i is at start + i * (recordSize + 1): sequence byte, then the record.
+// Sequence numbers count 0..0xFD and wrap; 0xFF marks an empty slot, and
+// 0xFE the last record sent by flush(), so that logging carries on after it
+// instead of going back to slot 0 and wearing that out first. The used
+// slots are always one unbroken run around the ring, so the oldest is the
+// one after an empty or sent slot, or after a break in the sequence if the
+// ring is full. A record is written before its sequence byte, so a reset
+// part way through leaves the slot empty rather than half-written.
+//
+// Sent records are: 0xFC, then the record's bytes.
+
+static const uint8_t LogEmpty  = 0xFF;
+static const uint8_t LogSent   = 0xFE;
+static const uint8_t LogMarker = 0xFC;
+static const uint8_t LogXON    = 0x11;
+static const uint8_t LogXOFF   = 0x13;
+
+static uint8_t logNextSeq(const uint8_t seq) {return (seq >= 0xFD)? 0 : seq + 1;}
+
+static uint8_t* logSlot(const EEPROMLog& l, const uint8_t i)
+{
+    return (uint8_t*)(l.start + (uint16_t)i * (l.recordSize + 1));
+}
+
+// A ring of no slots, or of empty records, would read outside its region
+// and divide by zero: refuse it, and leave the log switched off.
+bool EEPROMLog::begin(void)
+{
+    head = 0;
+    count = 0;
+    seq = 0;
+    connected = false;
+
+    if ((slots == 0) || (slots > 253) || (recordSize == 0))
+    {
+        slots = 0;
+        return false;
+    }
+
+    uint8_t afterSent = 0;
+    uint8_t prev = eeprom_read_byte(logSlot(*this, slots - 1));
+    for (uint8_t i = 0; i < slots; i++)
+    {
+        uint8_t s = eeprom_read_byte(logSlot(*this, i));
+        if (s == LogSent) afterSent = (i + 1) % slots;
+        else if (s != LogEmpty)
+        {
+            ++count;
+            if ((prev == LogEmpty) || (prev == LogSent) || (s != logNextSeq(prev)))
+                head = i;
+        }
+        prev = s;
+    }
+    if (count)
+    {
+        uint8_t newest = (head + count - 1) % slots;
+        seq = logNextSeq(eeprom_read_byte(logSlot(*this, newest)));
+    }
+    else head = afterSent;      // carry on after the last record sent.
+    return true;
+}
+
+void EEPROMLog::append(const void* record)
+{
+    if (!slots) return;
+    uint8_t tail = (head + count) % slots;
+    uint8_t* slot = logSlot(*this, tail);
+    if (count == slots)
+    {
+        eeprom_update_byte(slot, LogEmpty);   // full: lose the oldest.
+        head = (head + 1) % slots;
+        --count;
+    }
+    eeprom_update_block(record, slot + 1, recordSize);
+    eeprom_update_byte(slot, seq);
+    seq = logNextSeq(seq);
+    ++count;
+}
+
+void EEPROMLog::log(const void* record)
+{
+    if (!slots) return;
+    if (!connected) {append(record); return;}
+    DietSerial.write(LogMarker);
+    DietSerial.write((const uint8_t*)record, recordSize);
+}
+
+// Send everything first, at full speed, then mark the slots empty: each
+// EEPROM write takes about 3.4 ms, which would hold the sending back to
+// about 300 records a second if done record by record. A reset while the
+// slots are being emptied leaves the rest to be sent again next time.
+uint8_t EEPROMLog::flush(void)
+{
+    if (!slots) return 0;
+    for (uint8_t k = 0; k < count; k++)
+    {
+        const uint8_t* slot = logSlot(*this, (head + k) % slots);
+        DietSerial.write(LogMarker);
+        for (uint16_t j = 1; j <= recordSize; j++)
+            {DietSerial.write(eeprom_read_byte(slot + j));}
+    }
+
+    // The slot before head may hold the last flush's marker.
+    const uint8_t sent = count;
+    if (count)
+    {
+        uint8_t* before = logSlot(*this, (head + slots - 1) % slots);
+        if (eeprom_read_byte(before) == LogSent) eeprom_update_byte(before, LogEmpty);
+    }
+    while (count)
+    {
+        eeprom_update_byte(logSlot(*this, head), (count == 1)? LogSent : LogEmpty);
+        head = (head + 1) % slots;
+        --count;
+    }
+    return sent;
+}
+
+void EEPROMLog::poll(void)
+{
+    if (!DietSerial.available()) return;
+    uint8_t b = DietSerial.readByte();
+    if (DietSerial.error()) return;
+    if (b == LogXON)  {connected = true; flush();}
+    if (b == LogXOFF) {connected = false;}
+}
+
+
 // The object:
 struct AVR_USART DietSerial;
@@ -38,6 +38,8 @@
   2014. Chapter 9 on serial communications using the USART.
 */
 
+#include <util/atomic.h>         // ATOMIC_BLOCK for flush().
+
 #include "DietSerial_macros.h"  // debugging convenience prints.
 
 
@@ -56,10 +58,62 @@ enum LookaheadMode
 };
 #endif
 
+// Defined by DietSerialPower.h, if the sketch includes it: turns the USART
+// back on after it has switched itself off between transmissions.
+void dietSerialPowerOn(void) __attribute__((weak));
+
+// Defined by DietSerialAsync.h, if the sketch includes it: waits for the
+// background queue to be sent.
+void dietSerialAsyncWait(void) __attribute__((weak));
+
 // Receive error code.
 typedef uint8_t rxerr_t;
 // 0 = no error, 1 = timeout, 2 = garbled byte, 4 = other,
-// 8 = buffer too small to hold data.
+// 8 = buffer too small to hold data, 16 = data overrun (readBlock()).
+// readBlock() can set more than one: 2 + 16 = 18.
+
+// XMODEM block handler: called with each 128-byte block as it arrives, in
+// order, blockIndex counting from 0. Return false to cancel the transfer.
+typedef bool (*xmodemhandler_t)(const uint8_t* block, const size_t blockIndex);
+
+// Variable watch-list for telemetryTick(). The list of variables is a
+// PROGMEM array made with WATCHVAR(); the sketch also supplies a RAM array
+// big enough to hold a copy of all the variables, to detect changes:-
+//   static const watchvar_t watched[] PROGMEM = {WATCHVAR(count), WATCHVAR(temp)};
+//   uint8_t watchCopy[sizeof(count) + sizeof(temp)];
+//   watchlist_t watch = {watched, 2, watchCopy, sizeof(watchCopy)};
+
+typedef struct {
+    char    name[12];   // up to 11 characters.
+    void*   addr;
+    uint8_t size;
+    char    kind;       // 'i' signed, 'u' unsigned, 'f' floating-point, 'x' other
+} watchvar_t;
+
+typedef struct {
+    const watchvar_t* vars;     // in PROGMEM
+    uint8_t           count;    // up to 32
+    uint8_t*          shadow;
+    size_t            shadowLen;
+} watchlist_t;
+
+// kind for a variable's type, ignoring const and volatile.
+template <typename T> struct watchkind_               {static const char kind = 'x';};
+template <typename T> struct watchkind_<const T>      : watchkind_<T> {};
+template <typename T> struct watchkind_<volatile T>   : watchkind_<T> {};
+template <typename T> struct watchkind_<const volatile T> : watchkind_<T> {};
+template <> struct watchkind_<signed char>   {static const char kind = 'i';};
+template <> struct watchkind_<int>           {static const char kind = 'i';};
+template <> struct watchkind_<long>          {static const char kind = 'i';};
+template <> struct watchkind_<bool>          {static const char kind = 'u';};
+template <> struct watchkind_<char>          {static const char kind = 'u';};
+template <> struct watchkind_<unsigned char> {static const char kind = 'u';};
+template <> struct watchkind_<unsigned int>  {static const char kind = 'u';};
+template <> struct watchkind_<unsigned long> {static const char kind = 'u';};
+template <> struct watchkind_<float>         {static const char kind = 'f';};
+template <> struct watchkind_<double>        {static const char kind = 'f';};
+
+#define WATCHVAR(v) {#v, (void*)&(v), sizeof(v), watchkind_<decltype(v)>::kind}
 
 /* Binary bytes to integer/fp conversion unions for read and write fns. */
 
@@ -75,6 +129,77 @@ typedef union {
     long    l;
 } quadbyte;
 
+// Command table for dispatch(), see there.
+typedef void (*commandhandler_t)(const quadbyte* args);
+
+typedef struct {
+    char             name[10];  // up to 9 characters.
+    char             args[5];   // up to 4 of 'i' (long) or 'f' (float).
+    commandhandler_t handler;
+} command_t;
+
+
+// Results of selfTest().
+typedef struct {
+    unsigned long baud;             // actually produced by UBRR0/U2X0.
+    uint32_t      bytesPerSecond;   // sent and received back.
+    uint16_t      latencyMin;       // microseconds for one byte out and back,
+    uint16_t      latencyMean;      //  including its 10 bits on the wire.
+    uint16_t      latencyMax;
+    uint16_t      mismatched;       // came back different.
+    uint16_t      garbled;          // frame or parity error.
+    uint16_t      overruns;         // received byte(s) lost before this one.
+    uint16_t      lost;             // never came back.
+} selftest_t;
+
+// A logical channel, from DietSerial.channel(n): the same print and write
+// functions, with a tag when the line changes to this channel.
+struct AVR_USART_Channel
+{
+    uint8_t n;                          // 0-15
+
+    void tag(void);                     // start of each call, if needed.
+    void put(const uint8_t b);          // one data byte, escaped.
+
+    void write(const uint8_t b);
+    void write(const uint8_t* buffer, const size_t numBytes);
+    void writeP(const uint8_t* buffer, const size_t numBytes);
+    void write(const char c);
+    void write(const int i);
+    void write(const long l);
+    void write(const float f);
+    void write(const double d);
+
+    void print(const char c);
+    void print(const char* s);
+    void print(const __FlashStringHelper* fsh);
+    void printP(const char* s);
+
+    void print(const double d, const int decimals = 4);
+    void print(const float  f, const int decimals = 4);
+    void print(const int    i, const int base = DEC);
+    void print(const long   l, const int base = DEC);
+    void print(const uint8_t       ub, const int base = DEC);
+    void print(const unsigned int  ui, const int base = DEC);
+    void print(const unsigned long ul, const int base = DEC);
+
+    void println(void);
+    void println(const char c);
+    void println(const char* s);
+    void println(const __FlashStringHelper* fsh);
+    void printlnP(const char* s);
+
+    void println(const double d, const int decimals = 4);
+    void println(const float  f, const int decimals = 4);
+    void println(const int    i, const int base = DEC);
+    void println(const long   l, const int base = DEC);
+    void println(const uint8_t       ub, const int base = DEC);
+    void println(const unsigned int  ui, const int base = DEC);
+    void println(const unsigned long ul, const int base = DEC);
+};
+
+// Handler for the bytes arriving on one channel, see ChannelDemux.
+typedef void (*channelhandler_t)(const uint8_t b);
 
 struct AVR_USART
 {
@@ -82,10 +207,34 @@ private:
     uint8_t timeout_seconds_;
     rxerr_t receive_err_;
 
+    bool endOfLine(const char c);     // CR (LF), LF, or null ends a line.
+    char readField(char* buf, const size_t bufLen); // returns the separator.
+    void skipLine(char c);                // discard to the end of the line.
+    bool findIn(const char* token, const char* terminator, const bool flash);
+    void waitQuiet(void);             // read until a receive timeout.
+
+    void writeSampleValue(const int16_t v);   // absolute, for writeSamples.
+
+    void telemetrySend(const watchlist_t& list, const bool all);
+
+    void dump(const uint8_t memory, uint16_t addr, size_t len, const bool raw);
+
+    void setBaud(const unsigned long baud);       // UBRR0 and U2X0 only.
+    bool switchBaud(const unsigned long newBaud); // one negotiation attempt.
+
 public:
     void begin(const unsigned long baudrate = 9600UL);  // baud rate.
     void end(void);                   // power off USART hardware module.
 
+    // Baud rate actually produced by the current UBRR0/U2X0 settings.
+    unsigned long getBaud(void);
+
+    // Agree on a faster baud rate with the host helper program
+    // (extras/host/dietserial_baud). Tries rates up to maxBaud, fastest first,
+    // and checks each with an echo test. Falls back to the current rate if
+    // no host helper answers. Returns the baud rate in use afterwards.
+    unsigned long negotiateBaud(const unsigned long maxBaud = 1000000UL);
+
     // =========================================================================
     // Receive Control and Monitoring
 
@@ -129,6 +278,12 @@ public:
 
     // Multi-byte binary data receive.
     size_t  readBytes(uint8_t* buf, const size_t bufLen);
+    // Fast bulk receive for high baud rates: len bytes into buf, checking
+    // for errors only once for the whole block. It doesn't stop at a garbled
+    // byte; error() afterwards is 2 if any byte was garbled, 16 if any were
+    // lost, 1 (plus those) if it timed out, 8 if len is 0, as readBytes().
+    // Returns the number of bytes stored.
+    size_t  readBlock(uint8_t* buf, const size_t len);
     // specific number formats
     char    readChar(void);       // char - signed 8bit
     void    read4bytes(quadbyte& qb);
@@ -136,6 +291,31 @@ public:
     float   readFloat(void);
     int     readInt(void);
     long    readLong(void);
+    // Variable-length integers from writeVarint(): readVarint() for unsigned
+    // values, readSignedVarint() for signed (zigzag) ones.
+    unsigned long readVarint(void);
+    long    readSignedVarint(void);
+    // Block of n samples from writeSamples(). Skips anything before the
+    // block's start marker. Returns the number of samples received.
+    size_t  readSamples(int16_t* buf, const size_t n);
+
+
+    // XMODEM-CRC upload: receive blocks into the 128-byte array block and hand
+    // each one, checked, to handler. Returns the number of blocks received.
+    // error() is 0 if the transfer completed, 1 if it gave up after 10
+    // retries, 4 if either end cancelled it.
+    size_t  receiveXmodem(uint8_t* block, xmodemhandler_t handler);
+
+
+    // Command lines: read a command name and its arguments, separated by
+    // spaces or commas, and call its handler with the arguments as args[0].l,
+    // args[1].f, etc. commands is a PROGMEM array in alphabetical order:-
+    //   static const command_t commands[] PROGMEM = {
+    //       {"led",  "i",  setLed},      // "led 1"
+    //       {"move", "if", move}};       // "move 3 -1.5"
+    // Returns false, with error() 4, if the command is not in the table or
+    // has too few arguments; or false on a receive error.
+    bool    dispatch(const command_t* commands, const uint8_t count);
 
 
     // =========================================================================
@@ -159,6 +339,20 @@ public:
                      const LookaheadMode mode = SKIP_ALL,
                      const char ignore = 0x7F);
 
+    // Read until delimiter; store the characters before it, null-terminated.
+    // Returns their count. Sets error 8 if buf fills up first.
+    size_t  readUntil(char* buf, const size_t bufLen, const char delimiter);
+
+    // Discard incoming data until token has been received: true.
+    // findUntil(): false if terminator is received first.
+    // false also on timeout or receive error; check error().
+    // Tokens can be in RAM, or in flash with F("...").
+    bool    find(const char* token);
+    bool    find(const __FlashStringHelper* token);
+    bool    findUntil(const char* token, const char* terminator);
+    bool    findUntil(const __FlashStringHelper* token,
+                      const __FlashStringHelper* terminator);
+
     // Extract a number out of incoming (or existing) text.
 
     double  parseFloat(const LookaheadMode mode = SKIP_ALL, const char ignore = 0x7F);
@@ -167,13 +361,30 @@ public:
     double  parseFloat(char* buf, const size_t bufLen); //from already-received data
     long    parseInt(char* buf, const size_t bufLen);   // already-received data
 
+    // Binary data sent as Base64 or Ascii85 text, see printBase64() below.
+    // Decode a line (up to CR-LF, LF, or null) into buf. Returns byte count.
+    size_t  readBase64(void* buf, const size_t bufLen);
+    size_t  readBase85(void* buf, const size_t bufLen);
+
 
     // =========================================================================
     // Basic send monitoring functions.
 
     inline
     void flush(void)                  // Wait for last byte to be sent.
-        {loop_until_bit_is_set(UCSR0A, TXC0);}
+    {
+        // Wait for the DietSerialAsync queue, then the last byte.
+        // DietSerialPower.h switches the USART off when the last byte is sent;
+        // its registers can't be read then.
+        for (bool busy = true; busy; )
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                busy = bit_is_clear(PRR, PRUSART0)
+                    && (bit_is_set(UCSR0B, UDRIE0) || bit_is_clear(UCSR0A, TXC0));
+            }
+        }
+    }
 
     inline
     bool isReady(void)                // USART has room for a byte to send.
@@ -202,6 +413,20 @@ public:
     void write(const int i);
     void write(const long l);
 
+    // Variable-length integers (LEB128): 7 bits per byte, top bit set on all
+    // but the last byte. 0-127 take 1 byte, up to 16383 2 bytes, ... 5 bytes.
+    // Signed values are zigzag-encoded first: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4
+    void writeVarint(const unsigned long ul);
+    void writeVarint(const long l);
+    inline
+    void writeVarint(const unsigned int ui) {writeVarint((unsigned long)ui);}
+    inline
+    void writeVarint(const int i)           {writeVarint((long)i);}
+
+    // Block of 16-bit samples (ADC readings etc.), delta-encoded: most
+    // samples take 1 byte or less when successive readings are close.
+    void writeSamples(const int16_t* samples, const size_t n);
+
     // Bytes that are in program memory (flash):-
     void writeP(const uint8_t* buffer, const size_t numBytes);
 
@@ -214,6 +439,7 @@ public:
                                        // better than print(b, 2)
     void printDigit(uint8_t b);        // least signif. 4 bits -> char 0-9,a-f
     void print(const bool b);          // "true", "false"
+    void printHex(const uint8_t b);    // always two digits, 00-ff
 
     void print(const char c);          // aka int8_t, receiver thinks ASCII
 
@@ -257,6 +483,70 @@ public:
     void printP(const char*);
     void printlnP(const char*);
 
+    // =========================================================================
+    // Binary data as 7-bit text, for hosts that only accept text.
+    // Base64 (RFC 4648): 3 bytes -> 4 characters, padded with '='.
+    // Ascii85 (Adobe, without <~ ~>): 4 bytes -> 5 characters, 'z' for 0000.
+    // No line ending is added: follow with println().
+
+    void printBase64(const void* data, const size_t len);
+    void printBase85(const void* data, const size_t len);
+
+    // =========================================================================
+    // Variable watch-list telemetry, read by extras/host/dietserial_watch.
+    // telemetryBegin() sends the names and all the values; returns false if
+    // the list has more than 32 variables or the shadow array is too small.
+    // telemetryTick() sends only the variables that changed since last time,
+    // or nothing if none did, or if the list is one telemetryBegin() refuses.
+
+    bool telemetryBegin(const watchlist_t& list);
+    void telemetryTick(const watchlist_t& list);
+
+    // =========================================================================
+    // Logical channels 0-15 sharing the one USART, e.g. debug text on one,
+    // binary telemetry on another. A call on a different channel from the
+    // last one starts with DLE (0x10) and the channel number; calls on
+    // channel 0 always do. DLE in the data is sent twice. Output without
+    // channel() carries no tag: it goes on the channel used last, channel 0
+    // until another one is used. extras/host/dietserial_demux splits them
+    // up again on the PC.
+    //   DietSerial.channel(1).println(F("debug text"));
+    //   AVR_USART_Channel telemetry = DietSerial.channel(2);
+    //   telemetry.write(temperature);
+    // See ChannelDemux for receiving.
+
+    AVR_USART_Channel channel(const uint8_t n)
+        {AVR_USART_Channel c = {(uint8_t)(n & 0x0F)}; return c;}
+
+    // =========================================================================
+    // Memory dumps, 16 bytes per line:
+    // 0100  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0d 0a 00  |Hello, world!...|
+    // With raw = true the bytes are sent unformatted, as write() does.
+
+    void dumpHex(const void* addr, const size_t len, const bool raw = false);
+    void dumpEEPROM(const uint16_t addr, const size_t len, const bool raw = false);
+    void dumpFlash(const void* addr, const size_t len, const bool raw = false);
+
+    // =========================================================================
+    // Stack use. stackPaint() fills the unused RAM between the heap and the
+    // stack with a pattern; stackHighWater() returns the deepest the stack
+    // has reached since, in bytes from the top of RAM. To measure a call:-
+    //   DietSerial.stackPaint();
+    //   size_t before = DietSerial.stackHighWater();
+    //   DietSerial.print(3.14159);
+    //   size_t used = DietSerial.stackHighWater() - before;
+
+    void   stackPaint(void);
+    size_t stackHighWater(void);
+
+    // =========================================================================
+    // Loopback test at baud, with a wire from TX to RX or the host helper
+    // extras/host/dietserial_echo: times 16 single bytes out and back, then
+    // sends bytes more as fast as they go. Uses Timer1 and restores it and
+    // the baud rate afterwards. True if every byte came back intact.
+    bool selfTest(const unsigned long baud, const uint16_t bytes,
+                  selftest_t& result);
+
     // Convenience functions for common characters
 
     // whitespace
@@ -295,4 +585,115 @@ public:
 // The object:
 extern struct AVR_USART DietSerial;
 
-#endif
\ No newline at end of file
+
+// A command table and its size, for running commands from loop():-
+//   CommandDispatcher console = {commands, 2};
+//   void loop() { console.poll(); ... }
+struct CommandDispatcher
+{
+    const command_t* commands;  // PROGMEM, in alphabetical order.
+    uint8_t          count;
+
+    // Wait for a command line and run it.
+    inline
+    bool dispatch(void) {return DietSerial.dispatch(commands, count);}
+
+    // Run a command if one has started to arrive; otherwise return false.
+    inline
+    bool poll(void)     {return DietSerial.available() && dispatch();}
+};
+
+
+// Offline log: fixed-size binary records kept in an EEPROM ring while no
+// host is listening, and sent when one says hello. Each slot in the ring
+// is one sequence byte (0xFF = empty, 0xFE = last sent) then the record, so
+// the ring needs no head and tail pointers stored at fixed EEPROM addresses,
+// which would wear out long before the rest.
+//   EEPROMLog offline = {0, 50, 8};  // EEPROM 0..449: 50 records of 8 bytes
+//   offline.begin();                 // in setup()
+//   offline.poll();                  // in loop()
+//   offline.log(&record);            // sends it, or keeps it in EEPROM
+struct EEPROMLog
+{
+    uint16_t start;         // first EEPROM address.
+    uint8_t  slots;         // number of records, up to 253.
+    uint8_t  recordSize;    // bytes in each record.
+
+    // Set by begin():
+    uint8_t  head;          // oldest record.
+    uint8_t  count;         // records waiting to be sent.
+    uint8_t  seq;           // sequence number for the next record.
+    bool     connected;     // host has sent XON (0x11), not yet XOFF (0x13).
+
+    bool    begin(void);    // find the records already in EEPROM. false if
+                            // slots or recordSize is 0, or slots > 253: the
+                            // log is then switched off (slots = 0).
+    void    log(const void* record);
+    void    append(const void* record);    // always to EEPROM.
+    uint8_t flush(void);    // send all records, oldest first; returns count.
+    void    poll(void);     // XON: send the backlog, then log() sends live.
+                            // XOFF: log() goes back to EEPROM.
+};
+
+// Incoming channels, sent by extras/host/dietserial_demux: calls the
+// handler for channel n with each byte that arrives on it. handlers is a
+// PROGMEM array, from channel 0; a 0 handler, or a channel beyond count,
+// discards its data. Data before the first channel tag is on channel 0.
+//   static const channelhandler_t handlers[] PROGMEM = {onConsole, onConfig};
+//   ChannelDemux demux = {handlers, 2};
+//   void loop() { demux.poll(); ... }
+struct ChannelDemux
+{
+    const channelhandler_t* handlers;   // PROGMEM
+    uint8_t                 count;
+
+    uint8_t current;    // channel now arriving.
+    bool    escape;     // DLE received, deciding what it means.
+
+    void receive(const uint8_t b);      // one byte, already read.
+    void poll(void);    // all the bytes already received; doesn't wait.
+};
+
+#ifndef NDEBUG
+// PROFILE_END's records wait here for PROFILE_FLUSH(), see
+// DietSerial_macros.h. Only takes RAM if the sketch uses PROFILE_END.
+#ifndef DIETSERIAL_PROFILE_SLOTS
+#define DIETSERIAL_PROFILE_SLOTS 16
+#endif
+
+struct dietSerialProfile_t
+{
+    uint8_t  count;
+    uint8_t  id[DIETSERIAL_PROFILE_SLOTS];
+    uint16_t cycles[DIETSERIAL_PROFILE_SLOTS];
+};
+
+inline dietSerialProfile_t& dietSerialProfileRing(void)
+{
+    static dietSerialProfile_t ring;
+    return ring;
+}
+
+inline void dietSerialProfileFlush(void)
+{
+    dietSerialProfile_t& ring = dietSerialProfileRing();
+    for (uint8_t i = 0; i < ring.count; i++)
+    {
+        DietSerial.write((uint8_t)0xFE);
+        DietSerial.write(ring.id[i]);
+        DietSerial.write((int)ring.cycles[i]);
+    }
+    ring.count = 0;
+}
+
+inline void dietSerialProfileStore(const uint8_t id, const uint16_t cycles)
+{
+    dietSerialProfile_t& ring = dietSerialProfileRing();
+    if (ring.count == DIETSERIAL_PROFILE_SLOTS) dietSerialProfileFlush();
+    ring.id[ring.count]     = id;
+    ring.cycles[ring.count] = cycles;
+    ++ring.count;
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef DIETSERIAL_ASYNC_H
+#define DIETSERIAL_ASYNC_H
+
+// Background sending for DietSerial, straight from flash or from the
+// sketch's own RAM: no transmit buffer.
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+/*
+  Include this file in ONE .ino or .cpp file of the sketch: it defines the
+  USART "data register empty" interrupt handler and the queue.
+
+  DietSerialAsync.print(F("...")) and friends put a descriptor - where the
+  bytes are, how many, flash or RAM - in a small queue and return at once.
+  The interrupt handler sends the bytes one by one while the sketch gets on
+  with other work. If the queue is full they wait for a free place.
+
+  RAM strings and buffers are NOT copied: leave them unchanged until they
+  have been sent (flush()). String literals and F() strings are safe.
+
+  DietSerial's own print() and write() functions wait for the queue to be
+  sent before sending anything themselves, so output stays in order.
+  Don't call any of them with interrupts disabled, e.g. inside an ISR.
+
+  Queue size: #define DIETSERIAL_ASYNC_SLOTS before including this file.
+  Each slot is 5 bytes of RAM; one slot is always kept empty.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "DietSerial.h"
+
+#ifndef DIETSERIAL_ASYNC_SLOTS
+#define DIETSERIAL_ASYNC_SLOTS 4
+#endif
+
+typedef struct {
+    const uint8_t* data;
+    uint16_t       len;
+    bool           flash;
+} txdesc_t;
+
+txdesc_t         dietSerialTxQueue[DIETSERIAL_ASYNC_SLOTS];
+volatile uint8_t dietSerialTxHead;  // being sent by the ISR.
+volatile uint8_t dietSerialTxTail;  // next free slot.
+
+ISR(USART_UDRE_vect)
+{
+    txdesc_t& d = dietSerialTxQueue[dietSerialTxHead];
+    UDR0 = d.flash? pgm_read_byte(d.data) : *d.data;
+    ++d.data;
+    if (--d.len == 0)
+    {
+        uint8_t head = dietSerialTxHead + 1;
+        if (head == DIETSERIAL_ASYNC_SLOTS) head = 0;
+        dietSerialTxHead = head;
+        if (head == dietSerialTxTail) UCSR0B &= ~(1<<UDRIE0);  // all sent.
+    }
+}
+
+// DietSerial calls this, if it is linked in, before it sends anything itself
+// or changes the USART. If DietSerialPower.h has switched the USART off, the
+// queue is empty, and UCSR0B can't be read.
+void dietSerialAsyncWait(void)
+{
+    for (bool busy = true; busy; )
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {busy = bit_is_clear(PRR, PRUSART0) && bit_is_set(UCSR0B, UDRIE0);}
+    }
+}
+
+
+struct AVR_USART_Async
+{
+    void queue(const void* data, const uint16_t len, const bool flash)
+    {
+        if (!data || (len == 0)) return;
+        uint8_t next = dietSerialTxTail + 1;
+        if (next == DIETSERIAL_ASYNC_SLOTS) next = 0;
+        while (next == dietSerialTxHead) {}     // full: wait for the ISR.
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            txdesc_t& d = dietSerialTxQueue[dietSerialTxTail];
+            d.data  = (const uint8_t*)data;
+            d.len   = len;
+            d.flash = flash;
+            dietSerialTxTail = next;
+            if (dietSerialPowerOn && (PRR & (1<<PRUSART0))) dietSerialPowerOn();
+            UCSR0B |= (1<<UDRIE0);
+        }
+    }
+
+    // Bytes in RAM: leave them unchanged until sent.
+    inline void write(const uint8_t* buf, const size_t numBytes)
+        {queue(buf, numBytes, false);}
+    inline void print(const char* s)
+        {if (s) queue(s, strlen(s), false);}
+
+    // Bytes in flash.
+    inline void writeP(const uint8_t* buf, const size_t numBytes)
+        {queue(buf, numBytes, true);}
+    inline void printP(const char* s)
+        {if (s) queue(s, strlen_P(s), true);}
+    inline void print(const __FlashStringHelper* fsh)
+        {printP(reinterpret_cast<const char*>(fsh));}
+
+    inline void println(void)
+        {static const char crlf[] PROGMEM = "\r\n"; printP(crlf);}
+    inline void println(const char* s)
+        {print(s); println();}
+    inline void printlnP(const char* s)
+        {printP(s); println();}
+    inline void println(const __FlashStringHelper* fsh)
+        {print(fsh); println();}
+
+    // Is the queue still being sent?
+    inline bool busy(void)
+        {return bit_is_set(UCSR0B, UDRIE0);}
+
+    // Wait for the queue to be sent, and the last byte to leave.
+    inline void flush(void)
+        {DietSerial.flush();}
+};
+
+AVR_USART_Async DietSerialAsync;
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef DIETSERIAL_POWER_H
+#define DIETSERIAL_POWER_H
+
+// Automatic USART power-off between transmissions, for battery loggers.
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+/*
+  Include this file in ONE .ino or .cpp file of the sketch: it defines the
+  USART "transmit complete" interrupt handler.
+
+  After DietSerialPower.begin(), the USART switches its clock off (PRR) as
+  soon as the last byte has left, and DietSerial's write() and print()
+  functions switch it back on, once per call, when they have something to
+  send. Turning it on is six register writes from values saved by begin(),
+  with no baud rate arithmetic. The first byte after a switch-off waits
+  about 50 CPU cycles longer, 3 microseconds at 16 MHz, counted from the
+  instructions rather than measured; its start bit then follows within one
+  bit time, as usual. The current saved has not been measured either.
+
+  The USART can't receive while it is off. Call DietSerialPower.end() before
+  reading, and begin() again afterwards; DietSerial.selfTest() does without.
+  Call begin() again after negotiateBaud() or DietSerial.begin() with a new
+  baud rate.
+
+  While the USART is off the TX pin is an ordinary output, held high (idle)
+  so that the receiver doesn't see a break or noise.
+
+  RAM: 3 bytes.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "DietSerial.h"
+
+uint8_t dietSerialPowerUBRR0H;
+uint8_t dietSerialPowerUBRR0L;
+uint8_t dietSerialPowerU2X0;
+
+void dietSerialPowerOn(void)
+{
+    PRR   &= ~(1<<PRUSART0);
+    UBRR0H = dietSerialPowerUBRR0H;
+    UBRR0L = dietSerialPowerUBRR0L;
+    UCSR0A = dietSerialPowerU2X0;
+    UCSR0C = (1<<UCSZ01) | (1<<UCSZ00);     // 8N1, as begin().
+    UCSR0B = (1<<RXEN0) | (1<<TXEN0) | (1<<TXCIE0);
+}
+
+// Last byte sent. Don't switch off if DietSerialAsync has more to send,
+// or another byte is already waiting in UDR0.
+ISR(USART_TX_vect)
+{
+    if (UCSR0B & (1<<UDRIE0))     return;
+    if (!(UCSR0A & (1<<UDRE0)))   return;
+    UCSR0B = 0;
+    PRR   |= (1<<PRUSART0);
+}
+
+
+struct AVR_USART_Power
+{
+    void begin(void)
+    {
+        DietSerial.flush();
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (PRR & (1<<PRUSART0)) return;    // already off, nothing to save.
+            dietSerialPowerUBRR0H = UBRR0H;
+            dietSerialPowerUBRR0L = UBRR0L;
+            dietSerialPowerU2X0   = UCSR0A & (1<<U2X0);
+            PORTD |= (1<<PD1);                  // TX idles high when off.
+            DDRD  |= (1<<PD1);
+            // If a byte has already been sent TXC0 is set, and the
+            // interrupt switches the USART off straight away.
+            UCSR0B |= (1<<TXCIE0);
+        }
+    }
+
+    // Back to normal: USART on, and left on.
+    void end(void)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (PRR & (1<<PRUSART0)) dietSerialPowerOn();
+            UCSR0B &= ~(1<<TXCIE0);
+        }
+    }
+
+    // Is the USART switched off at the moment?
+    inline bool off(void)
+        {return bit_is_set(PRR, PRUSART0);}
+};
+
+AVR_USART_Power DietSerialPower;
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef DIETSERIAL_STREAM_H
+#define DIETSERIAL_STREAM_H
+
+// Arduino Print / Stream adapter for DietSerial, for other libraries that
+// want a Print& or Stream& to write their output to: no buffers.
+
+// GvP, 2025.   MIT licence.
+// https://github.com/gvp-257/DietSerial
+
+/*
+  Include this file in ONE .ino or .cpp file of the sketch, and pass
+  DietSerialStream wherever a library wants Serial:-
+
+    #include "DietSerialStream.h"
+    sensor.printDetails(DietSerialStream);      // takes a Print&
+
+  Writing goes straight to DietSerial.write(). Reading does not wait:
+  read() and peek() return -1 if no byte has arrived, as Serial's do, and
+  peek() keeps the one byte it has looked at until read() takes it.
+  Stream's own readBytes(), parseInt() etc. wait using Stream's timeout in
+  milliseconds (setTimeout()), not DietSerial's.
+
+  RAM, estimated from the class layout rather than measured: the object is
+  14 bytes (Stream's timeout and start time, Print's write error, the
+  peeked byte, and the pointer to its table of virtual functions), plus
+  that table itself, which avr-gcc keeps in RAM: about 18 bytes. Still much
+  less than Serial's 175 or so. Flash use has not been measured.
+
+  For output only, #define DIETSERIAL_PRINT_ONLY before including this
+  file: it is then a Print, about 4 bytes, with a 12-byte table.
+
+  The class is final, so calls made on DietSerialStream itself, rather
+  than through a Print& or Stream&, go straight to the functions below.
+*/
+
+#include <avr/io.h>
+#include <Stream.h>
+
+#include "DietSerial.h"
+
+#ifdef DIETSERIAL_PRINT_ONLY
+class AVR_USART_Stream final : public Print
+#else
+class AVR_USART_Stream final : public Stream
+#endif
+{
+public:
+    using Print::write;     // write(const char*), etc.
+
+    void begin(const unsigned long baudrate = 9600UL)
+        {DietSerial.begin(baudrate);}
+
+    size_t write(uint8_t b) override
+        {DietSerial.write(b); return 1;}
+
+    size_t write(const uint8_t* buffer, size_t size) override
+        {DietSerial.write(buffer, size); return size;}
+
+    int availableForWrite(void) override
+        {return bit_is_set(UCSR0A, UDRE0)? 1 : 0;}
+
+    void flush(void) override
+        {DietSerial.flush();}
+
+#ifndef DIETSERIAL_PRINT_ONLY
+    int available(void) override
+        {return ((peeked_ >= 0)? 1 : 0) + (DietSerial.available()? 1 : 0);}
+
+    int read(void) override
+    {
+        int b = peek();
+        peeked_ = -1;
+        return b;
+    }
+
+    int peek(void) override
+    {
+        if ((peeked_ < 0) && DietSerial.available())
+        {
+            uint8_t b = DietSerial.readByte();
+            if (!DietSerial.error()) peeked_ = b;    // garbled: drop it.
+        }
+        return peeked_;
+    }
+
+private:
+    int16_t peeked_ = -1;   // -1: none.
+#endif
+};
+
+AVR_USART_Stream DietSerialStream;
+
+#endif
@@ -60,6 +60,38 @@ DietSerial.println(); \
 } while(0)
 #endif
 
+// Profiling: time a region of code in CPU cycles with Timer1.
+//
+// PROFILE_INIT() once in setup(): Timer1 counts every CPU clock cycle.
+// (This takes Timer1 from analogWrite() on pins 9 and 10, and from Servo.)
+// Then, in the same block of code:-
+//     PROFILE_BEGIN(3);
+//     ... code to time ...
+//     PROFILE_END(3);
+//     PROFILE_FLUSH();     // later, outside the timed code.
+// PROFILE_END only stores id and cycles in a RAM ring, about 20 cycles;
+// PROFILE_FLUSH sends them as 4-byte binary records: 0xFE, id, cycles (as
+// write(int)). extras/host/dietserial_profile collects min/mean/max for
+// each id. Ring size: #define DIETSERIAL_PROFILE_SLOTS (default 16, 3 bytes
+// each). When the ring is full PROFILE_END flushes it itself, which blocks
+// for 4 bytes' sending time per record, 4 ms each at 9600 baud: an outer
+// region around that PROFILE_END then counts the sending time as well.
+// Regions must be shorter than 65536 cycles, 4 ms at 16 MHz.
+
+#ifndef PROFILE_BEGIN
+#define PROFILE_INIT() do { \
+TCCR1A = 0; TCCR1B = (1<<CS10); \
+} while (0)
+
+#define PROFILE_BEGIN(id) \
+const uint16_t dietSerialProfile_##id = TCNT1
+
+#define PROFILE_END(id) \
+dietSerialProfileStore((id), TCNT1 - dietSerialProfile_##id)
+
+#define PROFILE_FLUSH() dietSerialProfileFlush()
+#endif
+
 #else
 #ifndef printReg
 #define printReg
@@ -70,6 +102,12 @@ DietSerial.println(); \
 #ifndef printFloatVar
 #define printFloatVar
 #endif
+#ifndef PROFILE_BEGIN
+#define PROFILE_INIT()
+#define PROFILE_BEGIN(id)
+#define PROFILE_END(id)
+#define PROFILE_FLUSH()
+#endif
 #endif //NDEBUG.
 
 // Arduino F macro.